@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+
+"""
+Turns the boot trace CakesFW saves to /cakes/boot_trace.bin into a per-phase table.
+
+Pass a second trace to compare against it, e.g. one of a previous release.
+"""
+
+from sys import argv, stderr, exit
+from struct import unpack_from, calcsize
+
+header_struct = {1: "<IIIII", 2: "<IIIIIII"}
+span_struct = "<16sIII"
+counter_struct = "<16sI"
+trace_magic = 0x43525443
+
+def die(string):
+    print(string, file=stderr)
+    exit(1)
+
+def load_trace(path):
+    try:
+        data = open(path, "rb").read()
+    except OSError:
+        die("Can't read file: %s" % path)
+
+    if len(data) < calcsize(header_struct[1]):
+        die("Trace too small: %s" % path)
+    magic, version = unpack_from("<II", data)
+    if magic != trace_magic:
+        die("Not a boot trace: %s" % path)
+    if not version in header_struct:
+        die("Unknown trace version %d: %s" % (version, path))
+    if len(data) < calcsize(header_struct[version]):
+        die("Trace too small: %s" % path)
+
+    header = unpack_from(header_struct[version], data)
+    tick_rate, count, first = header[2:5]
+    slots, counter_count = header[5:7] if version >= 2 else (count, 0)
+    spans_offset = calcsize(header_struct[version])
+    counters_offset = spans_offset + calcsize(span_struct) * slots
+    if count > slots or len(data) < counters_offset + calcsize(counter_struct) * counter_count:
+        die("Trace is truncated: %s" % path)
+
+    spans = []
+    for x in range(count):
+        # The list wraps around, start at the oldest span.
+        index = (first + x) % count
+        name, start, end, depth = unpack_from(span_struct, data, spans_offset + calcsize(span_struct) * index)
+        name = name.split(b'\0')[0].decode()
+        spans.append((name, (end - start) & 0xFFFFFFFF, depth))
+
+    # Sum up the time spent per phase, keeping the order they first showed up in.
+    phases = {}
+    for name, ticks, depth in spans:
+        if not name in phases:
+            phases[name] = [0, 0, depth]
+        phases[name][0] += ticks
+        phases[name][1] += 1
+
+    counters = {}
+    for x in range(counter_count):
+        name, value = unpack_from(counter_struct, data, counters_offset + calcsize(counter_struct) * x)
+        counters[name.split(b'\0')[0].decode()] = value
+
+    return tick_rate, phases, counters
+
+if len(argv) < 2:
+    die("Usage: %s <boot_trace.bin> [baseline boot_trace.bin]" % argv[0])
+
+tick_rate, phases, counters = load_trace(argv[1])
+ms = lambda ticks: ticks * 1000 / tick_rate
+
+if len(argv) > 2:
+    base_rate, base, base_counters = load_trace(argv[2])
+    print("%-24s %6s %10s %10s %10s" % ("phase", "count", "ms", "base ms", "delta ms"))
+    for name in list(phases) + [x for x in base if not x in phases]:
+        ticks, count, depth = phases.get(name, [0, 0, base.get(name, [0, 0, 0])[2]])
+        base_ticks = base.get(name, [0])[0]
+        print("%-24s %6d %10.3f %10.3f %+10.3f" % ("  " * depth + name, count, ms(ticks),
+            base_ticks * 1000 / base_rate, ms(ticks) - base_ticks * 1000 / base_rate))
+else:
+    print("%-24s %6s %10s" % ("phase", "count", "ms"))
+    for name in phases:
+        ticks, count, depth = phases[name]
+        print("%-24s %6d %10.3f" % ("  " * depth + name, count, ms(ticks)))
+
+if len(argv) > 2 and (counters or base_counters):
+    print()
+    print("%-24s %10s %10s %10s" % ("counter", "value", "base", "delta"))
+    for name in list(counters) + [x for x in base_counters if not x in counters]:
+        value = counters.get(name, 0)
+        base_value = base_counters.get(name, 0)
+        print("%-24s %10d %10d %+10d" % (name, value, base_value, value - base_value))
+elif counters:
+    print()
+    print("%-24s %10s" % ("counter", "value"))
+    for name in counters:
+        print("%-24s %10d" % (name, counters[name]))
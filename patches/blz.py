@@ -0,0 +1,116 @@
+#!/usr/bin/python3
+
+"""
+Compressor for the backwards LZ77 the 3DS uses for its code binaries, as decompressed by blz.c.
+
+Can be used on its own to compress a file, e.g. for the benchmark in standalone_patcher.
+"""
+
+from sys import argv, stderr, exit
+from struct import pack
+
+min_match = 3
+max_match = 0xF + min_match
+min_distance = 3
+max_distance = 0xFFF + min_distance
+max_candidates = 0x40
+
+def compress(data, raw_prefix=0):
+    """
+    Compress data so it can be decompressed in place.
+    The first raw_prefix bytes are left as they are.
+    Returns None if it doesn't get any smaller.
+    """
+
+    # The data is decompressed from the end, so compress it back to front.
+    data = bytes(data)
+    reverse = data[::-1]
+    size = len(reverse)
+    limit = size - raw_prefix
+
+    # Stream in the order it's read by the decompressor, and where we could stop.
+    stream = bytearray()
+    cuts = [(0, 0)]  # (decompressed, compressed)
+    chains = {}
+
+    def insert(position):
+        if position + min_match <= size:
+            chains.setdefault(reverse[position:position + min_match], []).append(position)
+
+    position = 0
+    tokens = 0
+    flags_at = 0
+    while position < limit:
+        if tokens % 8 == 0:
+            flags_at = len(stream)
+            stream.append(0)
+
+        # Look for the longest match behind us.
+        length = 0
+        distance = 0
+        longest = min(max_match, limit - position)
+        if longest >= min_match:
+            candidates = chains.get(reverse[position:position + min_match], [])
+            for candidate in reversed(candidates[-max_candidates:]):
+                candidate_distance = position - candidate
+                if candidate_distance > max_distance:
+                    break
+                if candidate_distance < min_distance:
+                    continue
+
+                candidate_length = min_match
+                while candidate_length < longest and \
+                        reverse[candidate + candidate_length] == reverse[position + candidate_length]:
+                    candidate_length += 1
+
+                if candidate_length > length:
+                    length = candidate_length
+                    distance = candidate_distance
+                    if length == longest:
+                        break
+
+        if length:
+            value = (length - min_match) << 12 | (distance - min_distance)
+            stream[flags_at] |= 0x80 >> (tokens % 8)
+            stream.append(value >> 8)
+            stream.append(value & 0xFF)
+        else:
+            length = 1
+            stream.append(reverse[position])
+
+        for x in range(length):
+            insert(position + x)
+        position += length
+        tokens += 1
+        cuts.append((position, len(stream)))
+
+    # Stop where we saved the most. Up to there, the decompressor never catches up with itself.
+    decompressed, compressed = max(cuts, key=lambda cut: cut[0] - cut[1])
+    stream = stream[:compressed]
+
+    prefix = data[:size - decompressed]
+    padding = -(len(prefix) + len(stream)) % 4
+    footer_size = padding + 8
+    stream_size = len(stream) + footer_size
+    compressed_size = len(prefix) + stream_size
+    if compressed_size >= size:
+        return None
+
+    return prefix + bytes(stream[::-1]) + b'\xFF' * padding + pack("<II",
+        footer_size << 24 | stream_size,
+        size - compressed_size
+    )
+
+if __name__ == "__main__":
+    if len(argv) < 3:
+        print("Usage: %s <input> <output>" % argv[0], file=stderr)
+        exit(1)
+
+    data = open(argv[1], "rb").read()
+    result = compress(data)
+    if result is None:
+        print("Doesn't compress: %s" % argv[1], file=stderr)
+        exit(1)
+
+    open(argv[2], "wb").write(result)
+    print("%s: 0x%X -> 0x%X bytes" % (argv[1], len(data), len(result)))
@@ -0,0 +1,132 @@
+#!/usr/bin/python3
+
+"""
+Binary deltas, as applied by delta.c: copies out of the original and inserted bytes.
+
+Can be used on its own to see how big the delta between two files is.
+"""
+
+from sys import argv, stderr, exit
+
+block = 8  # Bytes the source is indexed by
+min_copy = 12  # Copies shorter than this cost more than inserting the bytes
+max_candidates = 0x10
+
+def varint(value):
+    result = bytearray()
+    while value >= 0x80:
+        result.append(value & 0x7F | 0x80)
+        value >>= 7
+    result.append(value)
+    return bytes(result)
+
+def match_length(source, start, target, position):
+    """How many bytes of the target at position are the same as the source at start."""
+    length = 0
+    longest = min(len(source) - start, len(target) - position)
+
+    # Compare in chunks first, it's a lot faster than byte by byte.
+    while length + 0x40 <= longest and \
+            source[start + length:start + length + 0x40] == target[position + length:position + length + 0x40]:
+        length += 0x40
+    while length < longest and source[start + length] == target[position + length]:
+        length += 1
+
+    return length
+
+def diff(source, target):
+    """Returns the commands that turn source into target."""
+    source = bytes(source)
+    target = bytes(target)
+
+    index = {}
+    for start in range(len(source) - block + 1):
+        candidates = index.setdefault(source[start:start + block], [])
+        if len(candidates) < max_candidates:
+            candidates.append(start)
+
+    commands = bytearray()
+    inserted = bytearray()
+    source_position = 0  # Where the last copy ended
+
+    def flush():
+        if inserted:
+            commands.extend(varint(len(inserted) << 1 | 1))
+            commands.extend(inserted)
+            inserted.clear()
+
+    position = 0
+    while position < len(target):
+        # Carrying on where the last copy ended is the most common case, and the cheapest one.
+        best_start = source_position
+        best_length = match_length(source, source_position, target, position) if source_position < len(source) else 0
+
+        if best_length < min_copy:
+            for start in index.get(target[position:position + block], []):
+                length = match_length(source, start, target, position)
+                if length > best_length:
+                    best_start = start
+                    best_length = length
+
+        if best_length >= min_copy:
+            flush()
+            move = best_start - source_position
+            commands.extend(varint(best_length << 1))
+            # Zigzag encoded, so going back a little is as small as going forward a little.
+            commands.extend(varint(move << 1 if move >= 0 else (-move << 1) - 1))
+            source_position = best_start + best_length
+            position += best_length
+        else:
+            inserted.append(target[position])
+            position += 1
+
+    flush()
+    return bytes(commands)
+
+def apply(source, commands):
+    """The same as delta.c, to check the commands with."""
+    result = bytearray()
+    source_position = 0
+    position = 0
+
+    def read_varint():
+        nonlocal position
+        value = 0
+        shift = 0
+        while True:
+            byte = commands[position]
+            position += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                return value
+
+    while position < len(commands):
+        command = read_varint()
+        length = command >> 1
+        if command & 1:
+            result.extend(commands[position:position + length])
+            position += length
+        else:
+            move = read_varint()
+            source_position += move >> 1 if not move & 1 else -((move + 1) >> 1)
+            result.extend(source[source_position:source_position + length])
+            source_position += length
+
+    return bytes(result)
+
+if __name__ == "__main__":
+    if len(argv) < 3:
+        print("Usage: %s <original> <modified> [output]" % argv[0], file=stderr)
+        exit(1)
+
+    source = open(argv[1], "rb").read()
+    target = open(argv[2], "rb").read()
+    commands = diff(source, target)
+    if apply(source, commands) != target:
+        print("The delta doesn't reproduce the file, this is a bug", file=stderr)
+        exit(1)
+
+    if len(argv) > 3:
+        open(argv[3], "wb").write(commands)
+    print("%s: 0x%X bytes, delta against %s is 0x%X bytes" % (argv[2], len(target), argv[1], len(commands)))
@@ -135,6 +135,11 @@ if len(argv) > 2:
             else:
                 print("Address found: 0x%08X" % address)
 
+    if argv[2] == "layout":
+        # An entry for firm_layouts.yaml
+        for section in sections:
+            print("- {offset: 0x%08X, address: 0x%08X, size: 0x%08X}" % (section["offset"], section["address"], section["size"]))
+
     if argv[2] == "search_native":
         print("Signatures:")
         simple_search("\tpatch1", "C0 1C 76 E7")
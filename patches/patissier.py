@@ -2,7 +2,10 @@
 from sys import argv, stderr, exit
 from struct import pack, calcsize
 from yaml import load, dump
-from os.path import isfile
+from os.path import isfile, join, dirname, abspath
+from hashlib import sha256
+from blz import compress
+from delta import diff
 
 # If LibYAML is available, use that, as recommended by the PyYAML wiki.
 try:
@@ -11,16 +14,18 @@ except ImportError:
     from yaml import Loader, Dumper
 
 # Globals
-format_version = 1
+format_version = 2
 header_struct = "<BBB"
 patch_struct = "<B8sIIBBIBI"
-version_struct = "<III"
+version_struct = "<IIII"
 subtype_struct = "<HHI"
+delta_struct = "<8s32sII"
 patch_types = {
     "FIRM": 0,
     "Memory": 1,
     "Userland": 2,
-    "Sysmodule": 3
+    "Sysmodule": 3,
+    "Delta": 4
 }
 firm_types = {
     "NATIVE_FIRM": 0,
@@ -36,6 +41,8 @@ options_dict = {
     "emunand": 0b00000010,
     "save": 0b00000100
 }
+option_sorted = 0b10000000
+option_compressed = 0b01000000
 
 # Shitty function to kill itself
 def die(string):
@@ -48,8 +55,21 @@ def align(file, alignment):
     if x < alignment:
         file.write(b'\0' * x)
 
+# Translate a FIRM patch's address into an offset in the FIRM file, like the patcher would.
+# Returns zero if we don't know the layout of this FIRM, so the patcher does it itself.
+def file_offset(firm_type, console, version, address):
+    sections = layouts.get(firm_type, {}).get(console, {}).get(version)
+    if not sections:
+        return 0
+
+    for section in sections:
+        if address >= section["address"] and address < section["address"] + section["size"]:
+            return section["offset"] + (address - section["address"])
+
+    die("Address not in any section of %s-%s-%x: 0x%08X" % (firm_type, console, version, address))
+
 if len(argv) < 3:
-    die("Usage: %s <info.yaml> <output.cake>" % argv[0])
+    die("Usage: %s <info.yaml> <output.cake> [firm_layouts.yaml]" % argv[0])
 
 try:
     info = load(open(argv[1]), Loader=Loader)
@@ -57,6 +77,16 @@ except Exception as e:
     print(e)
     die("Failed to load the YAML file: %s" % argv[1])
 
+# The FIRM layouts are optional, and live next to this script by default.
+layouts_path = argv[3] if len(argv) > 3 else join(dirname(abspath(argv[0])), "firm_layouts.yaml")
+layouts = {}
+if isfile(layouts_path):
+    try:
+        layouts = load(open(layouts_path), Loader=Loader) or {}
+    except Exception as e:
+        print(e)
+        die("Failed to load the YAML file: %s" % layouts_path)
+
 if not "description" in info:
     die("Missing description in info")
 if not "patches" in info:
@@ -150,6 +180,7 @@ for patch_name in info["patches"]:
         # Most other patches have a bit more complicated structure.
         if not subtype in firm_types:
             die("Unknown subtype in patch: %s" % patch_name)
+        firm_type = subtype
 
         memory_id = 0
         memory_var = 0
@@ -176,6 +207,16 @@ for patch_name in info["patches"]:
         elif type == "Memory":
             # Memory patches themselves are indexed by default
             memory_name = patch_name
+        elif type == "Delta":
+            # Deltas put the FIRM section they apply to in place of the memory ID, zero being a sysmodule.
+            if not "target" in patch:
+                die("Missing target in patch: %s" % patch_name)
+            if patch["target"] == "Sysmodule":
+                memory_id = 0
+            elif isinstance(patch["target"], int) and patch["target"] in range(1, 4):
+                memory_id = patch["target"]
+            else:
+                die("Incompatible target in patch: %s" % patch_name)
 
         if memory_name:
             if not memory_name in memory_list:
@@ -189,6 +230,29 @@ for patch_name in info["patches"]:
             memory_var
         )
 
+    # Deltas are stored as the difference with what they change, see delta.py.
+    if type == "Delta":
+        if "variables" in patch:
+            die("Delta patches can't have variables: %s" % patch_name)
+        if not "source" in patch:
+            die("Missing source in patch: %s" % patch_name)
+        try:
+            source = open(patch["source"], "rb").read()
+        except FileNotFoundError:
+            die("Couldn't find source file: %s" % patch["source"])
+
+        program_id = b'\0' * 8
+        if memory_id == 0:
+            if patch_code[0x100:0x104] != b"NCCH" or source[0x100:0x104] != b"NCCH":
+                die("Sysmodule deltas need NCCH files: %s" % patch_name)
+            program_id = patch_code[0x118:0x120]
+            if source[0x118:0x120] != program_id:
+                die("The source is a different sysmodule: %s" % patch_name)
+
+        patch_code = pack(delta_struct, program_id, sha256(source).digest(), len(source), len(patch_code)) + \
+            diff(source, patch_code)
+        patch_size = len(patch_code)
+
     # Type is converted the same way in either case
     type = patch_types[type]
 
@@ -234,70 +298,99 @@ for patch_name in info["patches"]:
     versions = versions_offset
 
     # Process all different versions
-    for version in patch["versions"]:
-        if patch["type"] == "Userland":
-            pass
-            # Userland patches don't have console-specific versions
-            # TODO: Implement this.
-        else:
-            # Memory and FIRM patches, and Sysmodules, however, do have console-specific versions.
-            console = version
-            for version in patch["versions"][console]:
-                version_info = patch["versions"][console][version]
-
-                identifier = consoles_dict[console] << 16 | version
-
-                variables_info = None
-                if isinstance(version_info, int):
-                    # We support writing the offset without any hassle if there's no variables to specify.
-                    memory_offset = version_info
-                elif isinstance(version_info, list) and patch["type"] == "Memory":
-                    # We also support writing just the variables (FIRM patches require also specifying the offset)
-                    memory_offset = 0
-                    variables_info = version_info
-                elif isinstance(version_info, dict):
-                    if not "offset" in version_info:
-                        die("Missing offset in version: %s-%s-%x" % (patch_name, console, version))
-                    if not isinstance(version_info["offset"], int):
-                        die("Incompatible type for offset in version: %s-%s-%x" % (patch_name, console, version))
-                    if "variables" in version_info:
-                        if not isinstance(version_info["variables"], list):
-                            die("Incompatible type for variables in version: %s-%s-%x" % (patch_name, console, version))
-
-                        variables_info = version_info["variables"]
-
-                    memory_offset = version_info["offset"]
-                else:
-                    die("Incompatible type for version: %s-%s-%x" % (patch_name, console, version))
-
-                # Process the variables
-                version_variables = 0
-                if "variables" in patch:
-                    if not variables_info:
-                        die("Missing variables in version: %s-%s-%x" % (patch_name, console, version))
-                    if len(variables_info) != variable_count:
-                        die("Incorrect amount of variables in version: %s-%s-%x" % (patch_name, console, version))
-
-                    version_variables = variables_offset
-                    cake.seek(variables_offset)
-                    for variable in variables_info:
-                        if not isinstance(variable, int):
-                            die("Incompatible type for variable in version: %s-%s-%x" % (patch_name, console, version))
-
-                        cake.write(pack("<I", variable))
-                    variables_offset = cake.tell()
-
-                cake.seek(versions_offset)
-                cake.write(pack(version_struct,
-                    identifier,
-                    memory_offset,
-                    version_variables
-                ))
-                versions_offset = cake.tell()
+    if patch["type"] == "Userland":
+        pass
+        # Userland patches don't have console-specific versions
+        # TODO: Implement this.
+    else:
+        # Memory and FIRM patches, and Sysmodules, however, do have console-specific versions.
+        # Write them sorted by identifier, so the patcher can binary search them.
+        sorted_versions = sorted(
+            ((console, version) for console in patch["versions"] for version in patch["versions"][console]),
+            key=lambda x: consoles_dict[x[0]] << 16 | x[1]
+        )
+        options |= option_sorted
+
+        for console, version in sorted_versions:
+            version_info = patch["versions"][console][version]
+
+            identifier = consoles_dict[console] << 16 | version
+
+            variables_info = None
+            if isinstance(version_info, int):
+                # We support writing the offset without any hassle if there's no variables to specify.
+                memory_offset = version_info
+            elif isinstance(version_info, list) and patch["type"] == "Memory":
+                # We also support writing just the variables (FIRM patches require also specifying the offset)
+                memory_offset = 0
+                variables_info = version_info
+            elif isinstance(version_info, dict):
+                if not "offset" in version_info:
+                    die("Missing offset in version: %s-%s-%x" % (patch_name, console, version))
+                if not isinstance(version_info["offset"], int):
+                    die("Incompatible type for offset in version: %s-%s-%x" % (patch_name, console, version))
+                if "variables" in version_info:
+                    if not isinstance(version_info["variables"], list):
+                        die("Incompatible type for variables in version: %s-%s-%x" % (patch_name, console, version))
+
+                    variables_info = version_info["variables"]
+
+                memory_offset = version_info["offset"]
+            else:
+                die("Incompatible type for version: %s-%s-%x" % (patch_name, console, version))
+
+            # Process the variables
+            version_variables = 0
+            if "variables" in patch:
+                if not variables_info:
+                    die("Missing variables in version: %s-%s-%x" % (patch_name, console, version))
+                if len(variables_info) != variable_count:
+                    die("Incorrect amount of variables in version: %s-%s-%x" % (patch_name, console, version))
+
+                version_variables = variables_offset
+                cake.seek(variables_offset)
+                for variable in variables_info:
+                    if not isinstance(variable, int):
+                        die("Incompatible type for variable in version: %s-%s-%x" % (patch_name, console, version))
+
+                    cake.write(pack("<I", variable))
+                variables_offset = cake.tell()
+
+            # Only FIRM patches are placed at a fixed location
+            version_file_offset = 0
+            if type == patch_types["FIRM"]:
+                version_file_offset = file_offset(firm_type, console, version, memory_offset)
+
+            cake.seek(versions_offset)
+            cake.write(pack(version_struct,
+                identifier,
+                memory_offset,
+                version_variables,
+                version_file_offset
+            ))
+            versions_offset = cake.tell()
 
     # Skip over the variable arrays we put behind the versions array
     cake.seek(variables_offset)
 
+    # Compress the code if asked to. The patcher decompresses it right where it goes.
+    if "compress" in patch:
+        if not isinstance(patch["compress"], bool):
+            die("Incompatible type for compress in patch: %s" % patch_name)
+        if patch["compress"] and patch["type"] == "Userland":
+            die("Userland patches can't be compressed: %s" % patch_name)
+        if patch["compress"] and patch["type"] == "Delta":
+            die("Delta patches can't be compressed: %s" % patch_name)
+
+    if patch.get("compress"):
+        # Sysmodules keep their NCCH header as-is, so the patcher can look at it before decompressing.
+        compressed = compress(patch_code, 0x200 if patch["type"] == "Sysmodule" else 0)
+        if compressed is None:
+            print("Not compressing, it doesn't get any smaller: %s" % patch_name, file=stderr)
+        else:
+            options |= option_compressed
+            patch_code = pack("<I", len(compressed)) + compressed
+
     # Write the actual code to the file
     align(cake, 4)  # Align to 4 bytes
     patch_offset = cake.tell()  # The current location is the start of the patch
@@ -0,0 +1,11 @@
+#pragma once
+
+// Bit arrays, for keeping track of a lot of on/off states at once.
+
+#include <stdint.h>
+
+#define BITSET_SIZE(count) (((count) + 31) / 32)
+#define BITSET_GET(set, x) ((set)[(x) / 32] >> ((x) % 32) & 1)
+#define BITSET_SET(set, x) ((set)[(x) / 32] |= (uint32_t)1 << ((x) % 32))
+#define BITSET_CLEAR(set, x) ((set)[(x) / 32] &= ~((uint32_t)1 << ((x) % 32)))
+#define BITSET_TOGGLE(set, x) ((set)[(x) / 32] ^= (uint32_t)1 << ((x) % 32))
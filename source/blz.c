@@ -0,0 +1,61 @@
+#include "blz.h"
+
+#include <stdint.h>
+
+// The patch may end up anywhere, so don't rely on the footer being aligned.
+static uint32_t read_le32(const uint8_t *data)
+{
+    return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+// The compressed data is at the start of the buffer, and it's decompressed from the end backwards.
+// Anything in front of the compressed part, as the footer says, is stored as-is and left alone.
+int blz_decompress(void *buffer, const uint32_t compressed_size, const uint32_t decompressed_size)
+{
+    uint8_t *data = buffer;
+
+    if (compressed_size < 8 || decompressed_size < compressed_size) return 1;
+
+    uint32_t bounds = read_le32(data + compressed_size - 8);
+    uint32_t extra = read_le32(data + compressed_size - 4);
+    uint32_t footer_size = bounds >> 24;
+    uint32_t stream_size = bounds & 0xFFFFFF;
+
+    if (extra != decompressed_size - compressed_size ||
+            footer_size < 8 || footer_size > stream_size || stream_size > compressed_size) {
+        return 1;
+    }
+
+    uint32_t index = compressed_size - footer_size;
+    uint32_t stop = compressed_size - stream_size;
+    uint32_t out = decompressed_size;
+
+    while (index > stop) {
+        uint8_t control = data[--index];
+
+        for (int x = 0; x < 8 && index > stop; x++, control <<= 1) {
+            if (control & 0x80) {
+                if (index - stop < 2) return 1;
+                index -= 2;
+
+                uint32_t segment = data[index] | data[index + 1] << 8;
+                uint32_t size = (segment >> 12) + 3;
+                uint32_t offset = (segment & 0xFFF) + 3;
+
+                if (size > out - stop || out + offset > decompressed_size) return 1;
+                while (size--) {
+                    out--;
+                    data[out] = data[out + offset];
+                }
+            } else {
+                if (out == stop) return 1;
+                data[--out] = data[--index];
+            }
+
+            // Writing over data we haven't read yet means it wasn't compressed right.
+            if (out < index) return 1;
+        }
+    }
+
+    return out == stop ? 0 : 1;
+}
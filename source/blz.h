@@ -0,0 +1,8 @@
+#pragma once
+
+// The backwards LZ77 the 3DS uses for its code binaries.
+// It's decompressed in place, so compressed patches can be copied straight to where they go.
+
+#include <stdint.h>
+
+int blz_decompress(void *buffer, const uint32_t compressed_size, const uint32_t decompressed_size);
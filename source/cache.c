@@ -0,0 +1,42 @@
+#include "cache.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Anything the DMA engines touch has to be taken care of here first,
+//   as they don't know about the data cache.
+
+static void drain_write_buffer()
+{
+    __asm__ volatile ("mcr p15, 0, %0, c7, c10, 4" :: "r"(0) : "memory");
+}
+
+// Writes any dirty lines back to memory.
+void cache_clean_range(const void *start, const size_t size)
+{
+    for (uintptr_t line = (uintptr_t)start & ~(CACHE_LINE_SIZE - 1);
+            line < (uintptr_t)start + size; line += CACHE_LINE_SIZE) {
+        __asm__ volatile ("mcr p15, 0, %0, c7, c10, 1" :: "r"(line) : "memory");
+    }
+    drain_write_buffer();
+}
+
+// Writes any dirty lines back to memory, and drops them from the cache.
+void cache_flush_range(void *start, const size_t size)
+{
+    for (uintptr_t line = (uintptr_t)start & ~(CACHE_LINE_SIZE - 1);
+            line < (uintptr_t)start + size; line += CACHE_LINE_SIZE) {
+        __asm__ volatile ("mcr p15, 0, %0, c7, c14, 1" :: "r"(line) : "memory");
+    }
+    drain_write_buffer();
+}
+
+// Drops lines from the cache without writing them back.
+// Only use this on ranges that are aligned to CACHE_LINE_SIZE, or you'll lose data.
+void cache_invalidate_range(void *start, const size_t size)
+{
+    for (uintptr_t line = (uintptr_t)start & ~(CACHE_LINE_SIZE - 1);
+            line < (uintptr_t)start + size; line += CACHE_LINE_SIZE) {
+        __asm__ volatile ("mcr p15, 0, %0, c7, c6, 1" :: "r"(line) : "memory");
+    }
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stddef.h>
+
+// The ARM946E-S data cache has 32-byte lines.
+#define CACHE_LINE_SIZE 0x20
+
+void cache_clean_range(const void *start, const size_t size);
+void cache_flush_range(void *start, const size_t size);
+void cache_invalidate_range(void *start, const size_t size);
@@ -26,28 +26,18 @@
 
 #include "chainloader.h"
 #include "screen.h"
+#include "ndma.h"
 
 void disableMpuAndJumpToEntrypoints(int argc, char **argv, void *arm11Entry, void *arm9Entry);
 
 #pragma GCC optimize (3)
 
-static void *xmemcpy(void *dst, const void *src, u32 len)
-{
-    const u8 *src8 = (const u8 *)src;
-    u8 *dst8 = (u8 *)dst;
-
-    for (u32 i = 0; i < len; i++) {
-        dst8[i] = src8[i];
-    }
-
-    return dst;
-}
-
 static void doLaunchFirm(Firm *firm, int argc, char **argv)
 {
-    //Copy FIRM sections to respective memory locations
+    //Copy FIRM sections to respective memory locations, the big ones go through NDMA
     for(u32 sectionNum = 0; sectionNum < 4; sectionNum++)
-        xmemcpy(firm->section[sectionNum].address, (u8 *)firm + firm->section[sectionNum].offset, firm->section[sectionNum].size);
+        ndma_copy_start(firm->section[sectionNum].address, (u8 *)firm + firm->section[sectionNum].offset, firm->section[sectionNum].size);
+    ndma_copy_wait();
 
     disableMpuAndJumpToEntrypoints(argc, argv, firm->arm9Entry, firm->arm11Entry);
 
@@ -58,7 +58,7 @@ void load_config_cakes()
         for (unsigned int y = 0; y < config->cake_count && y < max_cakes; y++) {
             if (strncmp(cake_list[x].path, config->cake_list[y],
                         sizeof(config->cake_list[0])) == 0) {
-                cake_selected[x] = 1;
+                BITSET_SET(cake_selected, x);
             }
         }
     }
@@ -92,7 +92,7 @@ void save_config()
 
     config->cake_count = 0;
     for (unsigned int i = 0; i < cake_count && i < max_cakes; i++) {
-        if (cake_selected[i]) {
+        if (BITSET_GET(cake_selected, i)) {
             // This saves the full path...
             strncpy(config->cake_list[config->cake_count++],
                     cake_list[i].path, sizeof(config->cake_list[0]));
@@ -0,0 +1,68 @@
+#include "delta.h"
+
+#include <stdint.h>
+
+#ifndef STANDALONE
+#include "memfuncs.h"
+#else
+#include <string.h>
+#endif
+
+// LEB128, as the commands may start anywhere.
+static int read_varint(const uint8_t **pos, const uint8_t *end, uint32_t *value)
+{
+    uint32_t result = 0;
+
+    for (int shift = 0; shift < 32; shift += 7) {
+        if (*pos >= end) return 1;
+
+        uint8_t byte = *(*pos)++;
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Every command starts with its length << 1, with the lowest bit set for inserts.
+// Inserts are followed by their bytes, copies by how far to move in the source (zigzag encoded),
+//   relative to where the previous copy ended.
+int delta_apply(void *dest, const uint32_t dest_size, const void *source, const uint32_t source_size,
+        const void *commands, const uint32_t commands_size)
+{
+    const uint8_t *pos = commands;
+    const uint8_t *end = pos + commands_size;
+    uint32_t out = 0;
+    uint32_t in = 0;
+
+    while (pos < end) {
+        uint32_t command;
+        if (read_varint(&pos, end, &command) != 0) return 1;
+
+        uint32_t length = command >> 1;
+        if (length > dest_size - out) return 1;
+
+        if (command & 1) {
+            if (length > (uint32_t)(end - pos)) return 1;
+
+            memcpy(dest + out, pos, length);
+            pos += length;
+        } else {
+            uint32_t move;
+            if (read_varint(&pos, end, &move) != 0) return 1;
+
+            in += (move >> 1) ^ -(move & 1);
+            if (in > source_size || length > source_size - in) return 1;
+
+            memcpy(dest + out, source + in, length);
+            in += length;
+        }
+
+        out += length;
+    }
+
+    return out != dest_size;
+}
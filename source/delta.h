@@ -0,0 +1,16 @@
+#pragma once
+
+// Binary deltas: a new module or FIRM section, made out of pieces of the original and inserted bytes.
+// The commands are applied in order, straight into where the result goes. See patches/format.txt.
+
+#include <stdint.h>
+
+struct delta_header {
+    uint8_t program_id[8];  // For sysmodule deltas, which module it applies to.
+    uint8_t source_hash[32];  // SHA-256 of the original.
+    uint32_t source_size;
+    uint32_t target_size;
+};
+
+int delta_apply(void *dest, const uint32_t dest_size, const void *source, const uint32_t source_size,
+        const void *commands, const uint32_t commands_size);
@@ -4,6 +4,8 @@
 
 #include <stddef.h>
 #include "../memfuncs.h"
+#include "../cache.h"
+#include "../ndma.h"
 /* original version by megazig */
 
 #ifndef __thumb__
@@ -144,14 +146,8 @@ void aes_change_ctrmode(void* ctr, uint32_t fromMode, uint32_t toMode)
 	}
 }
 
-void aes_batch(void* dst, const void* src, uint32_t blockCount)
+static void aes_fifo_cpu(uint32_t* dst32, const uint32_t* src32, uint32_t blockCount)
 {
-	*REG_AESBLKCNT = blockCount << 16;
-	*REG_AESCNT |=	AES_CNT_START;
-	
-	const uint32_t* src32	= (const uint32_t*)src;
-	uint32_t* dst32			= (uint32_t*)dst;
-	
 	uint32_t wbc = blockCount;
 	uint32_t rbc = blockCount;
 	
@@ -177,6 +173,98 @@ void aes_batch(void* dst, const void* src, uint32_t blockCount)
 	}
 }
 
+void aes_batch(void* dst, const void* src, uint32_t blockCount)
+{
+	*REG_AESBLKCNT = blockCount << 16;
+	*REG_AESCNT |=	AES_CNT_START;
+	
+	aes_fifo_cpu((uint32_t*)dst, (const uint32_t*)src, blockCount);
+}
+
+// Reads REG_AESCNT once per round and then moves as many whole blocks as the
+//  FIFOs allow, using ldm/stm on the memory side. The FIFO registers don't
+//  auto-increment, so those are still accessed one word at a time.
+void aes_batch_burst(void* dst, const void* src, uint32_t blockCount)
+{
+	*REG_AESBLKCNT = blockCount << 16;
+	*REG_AESCNT |=	AES_CNT_START;
+
+	const uint32_t* src32	= (const uint32_t*)src;
+	uint32_t* dst32			= (uint32_t*)dst;
+
+	uint32_t wbc = blockCount;
+	uint32_t rbc = blockCount;
+
+	while(rbc)
+	{
+		uint32_t cnt = *REG_AESCNT;
+		uint32_t wblocks = (0x10 - (cnt & 0x1F)) / 4;	// Free blocks in the write FIFO
+		uint32_t rblocks = ((cnt >> 5) & 0x1F) / 4;		// Blocks waiting in the read FIFO
+
+		if(wblocks > wbc)
+			wblocks = wbc;
+		wbc -= wblocks;
+		rbc -= rblocks;
+
+		while(wblocks--)
+		{
+			__asm__ volatile
+			(
+				"ldmia %[src]!, {r4-r7}\n\t"
+				"str r4, [%[fifo]]\n\t"
+				"str r5, [%[fifo]]\n\t"
+				"str r6, [%[fifo]]\n\t"
+				"str r7, [%[fifo]]\n\t"
+				: [src] "+r" (src32)
+				: [fifo] "r" (REG_AESWRFIFO)
+				: "r4", "r5", "r6", "r7", "memory"
+			);
+		}
+
+		while(rblocks--)
+		{
+			__asm__ volatile
+			(
+				"ldr r4, [%[fifo]]\n\t"
+				"ldr r5, [%[fifo]]\n\t"
+				"ldr r6, [%[fifo]]\n\t"
+				"ldr r7, [%[fifo]]\n\t"
+				"stmia %[dst]!, {r4-r7}\n\t"
+				: [dst] "+r" (dst32)
+				: [fifo] "r" (REG_AESRDFIFO)
+				: "r4", "r5", "r6", "r7", "memory"
+			);
+		}
+	}
+}
+
+// Lets two NDMA channels move the data in and out of the FIFOs.
+// The DMA requests fire every AES_DMA_BLOCKS blocks, so any blocks left over
+//  are fed to the same running batch by the CPU.
+// standalone_patcher/aes_dma_model.c runs the same setup against a model of the hardware.
+void aes_batch_dma(void* dst, const void* src, uint32_t blockCount)
+{
+	uint32_t dmaBlocks = AES_DMA_SPLIT(blockCount);
+	uint32_t dmaWords = dmaBlocks * (AES_BLOCK_SIZE / 4);
+
+	// NDMA doesn't go through the data cache.
+	cache_clean_range(src, dmaBlocks * AES_BLOCK_SIZE);
+	cache_flush_range(dst, dmaBlocks * AES_BLOCK_SIZE);
+
+	*REG_AESBLKCNT = blockCount << 16;
+	*REG_AESCNT |=	AES_DMA_CNT;
+
+	ndma_start(NDMA_CHANNEL_AES_OUT, REG_AESRDFIFO, dst, dmaWords, AES_DMA_BLOCK_WORDS, AES_DMA_OUT_FLAGS);
+	ndma_start(NDMA_CHANNEL_AES_IN, src, REG_AESWRFIFO, dmaWords, AES_DMA_BLOCK_WORDS, AES_DMA_IN_FLAGS);
+
+	*REG_AESCNT |=	AES_CNT_START;
+
+	ndma_wait(NDMA_CHANNEL_AES_IN);
+	ndma_wait(NDMA_CHANNEL_AES_OUT);
+
+	aes_fifo_cpu((uint32_t*)dst + dmaWords, (const uint32_t*)src + dmaWords, blockCount - dmaBlocks);
+}
+
 inline void aes_setmode(uint32_t mode)
 {
 	*REG_AESCNT =	mode |
@@ -205,8 +293,13 @@ void aes(void* dst, const void* src, uint32_t blockCount, void* iv, uint32_t mod
 			aes_change_ctrmode(iv, AES_INPUT_BE | AES_INPUT_NORMAL, ivMode);
 		}
 
-		// Process the current batch
-		aes_batch(dst, src, blocks);
+		// Process the current batch, big word-aligned ones don't need the CPU
+		if(blocks >= AES_DMA_MIN_BLOCKS && !(((uintptr_t)dst | (uintptr_t)src) & 3))
+			aes_batch_dma(dst, src, blocks);
+		else if(blocks >= AES_BURST_MIN_BLOCKS && !(((uintptr_t)dst | (uintptr_t)src) & 3))
+			aes_batch_burst(dst, src, blocks);
+		else
+			aes_batch(dst, src, blocks);
 
 		// Save the last block for the next encryption CBC batch's iv
 		if((mode & AES_ALL_MODES) == AES_CBC_ENCRYPT_MODE)
@@ -262,35 +355,88 @@ void sha_wait_idle()
 	while(*REG_SHA_CNT & 1);
 }
 
-void sha(void* res, const void* src, uint32_t size, uint32_t mode)
+// The engine only holds one hash at a time, but its state lives on between
+//  calls. Data that doesn't fill a whole block is held back here.
+static struct {
+	uint32_t buffer[0x40 / 4];
+	uint32_t buffered;
+} sha_ctx;
+
+void sha_init(uint32_t mode)
 {
 	sha_wait_idle();
 	*REG_SHA_CNT = mode | SHA_CNT_OUTPUT_ENDIAN | SHA_NORMAL_ROUND;
-	
-	const uint32_t* src32	= (const uint32_t*)src;
-	int i;
+	sha_ctx.buffered = 0;
+}
+
+static void sha_block(const uint32_t* src32)
+{
+	sha_wait_idle();
+	for(int i = 0; i < 4; ++i)
+	{
+		*REG_SHA_INFIFO = *src32++;
+		*REG_SHA_INFIFO = *src32++;
+		*REG_SHA_INFIFO = *src32++;
+		*REG_SHA_INFIFO = *src32++;
+	}
+}
+
+// Takes any size and alignment, so it can be handed a file read buffer as is.
+void sha_update(const void* src, uint32_t size)
+{
+	const uint8_t* src8 = (const uint8_t*)src;
+
+	// Top up the last partial block first.
+	if(sha_ctx.buffered)
+	{
+		uint32_t fill = 0x40 - sha_ctx.buffered;
+		if(fill > size)
+			fill = size;
+		memcpy((uint8_t*)sha_ctx.buffer + sha_ctx.buffered, src8, fill);
+		sha_ctx.buffered += fill;
+		src8 += fill;
+		size -= fill;
+
+		if(sha_ctx.buffered < 0x40)
+			return;
+		sha_block(sha_ctx.buffer);
+		sha_ctx.buffered = 0;
+	}
+
 	while(size >= 0x40)
 	{
-		sha_wait_idle();
-		for(i = 0; i < 4; ++i)
+		if((uintptr_t)src8 & 3)
 		{
-			*REG_SHA_INFIFO = *src32++;
-			*REG_SHA_INFIFO = *src32++;
-			*REG_SHA_INFIFO = *src32++;
-			*REG_SHA_INFIFO = *src32++;
+			memcpy(sha_ctx.buffer, src8, 0x40);
+			sha_block(sha_ctx.buffer);
+		}
+		else
+		{
+			sha_block((const uint32_t*)src8);
 		}
 
+		src8 += 0x40;
 		size -= 0x40;
 	}
-	
+
+	memcpy(sha_ctx.buffer, src8, size);
+	sha_ctx.buffered = size;
+}
+
+void sha_final(void* res, const void* src, uint32_t size)
+{
+	sha_update(src, size);
+
 	sha_wait_idle();
-	memcpy((void*)REG_SHA_INFIFO, src32, size);
+	memcpy((void*)REG_SHA_INFIFO, sha_ctx.buffer, sha_ctx.buffered);
+	sha_ctx.buffered = 0;
 	
 	*REG_SHA_CNT = (*REG_SHA_CNT & ~SHA_NORMAL_ROUND) | SHA_FINAL_ROUND;
 	
 	while(*REG_SHA_CNT & SHA_FINAL_ROUND);
 	sha_wait_idle();
 	
+	uint32_t mode = *REG_SHA_CNT & SHA_CNT_MODE;
 	uint32_t hashSize = SHA_256_HASH_SIZE;
 	if(mode == SHA_224_MODE)
 		hashSize = SHA_224_HASH_SIZE;
@@ -300,6 +446,12 @@ void sha(void* res, const void* src, uint32_t size, uint32_t mode)
 	memcpy(res, (void*)REG_SHA_HASH, hashSize);
 }
 
+void sha(void* res, const void* src, uint32_t size, uint32_t mode)
+{
+	sha_init(mode);
+	sha_final(res, src, size);
+}
+
 void rsa_wait_idle()
 {
 	while(*REG_RSA_CNT & 1);
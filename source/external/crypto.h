@@ -35,6 +35,8 @@
 #define AES_CNT_OUTPUT_ENDIAN	0x00400000
 #define AES_CNT_FLUSH_READ		0x00000800
 #define AES_CNT_FLUSH_WRITE		0x00000400
+#define AES_CNT_WRFIFO_DMA_SIZE(words)	((((words) / 4) - 1) << 12)
+#define AES_CNT_RDFIFO_DMA_SIZE(words)	((((words) / 4) - 1) << 14)
 
 #define AES_INPUT_BE			(AES_CNT_INPUT_ENDIAN)
 #define AES_INPUT_LE			0
@@ -45,6 +47,21 @@
 
 #define AES_BLOCK_SIZE			0x10
 
+#define AES_DMA_BLOCKS			4		// Blocks moved per DMA request, the whole FIFO
+#define AES_DMA_MIN_BLOCKS		0x40	// Smaller batches aren't worth setting up the DMA
+#define AES_BURST_MIN_BLOCKS	8		// Enough to fill the FIFOs at least twice
+
+// How aes_batch_dma() splits a batch and sets up the FIFOs and NDMA channels (see ndma.h).
+// The words moved per request have to match the FIFO DMA sizes, or the channels stall.
+#define AES_DMA_SPLIT(blocks)	((blocks) & ~(AES_DMA_BLOCKS - 1))	// Blocks moved by the DMA, the CPU does the rest
+#define AES_DMA_BLOCK_WORDS		(AES_DMA_BLOCKS * AES_BLOCK_SIZE / 4)
+#define AES_DMA_CNT				(AES_CNT_WRFIFO_DMA_SIZE(AES_DMA_BLOCK_WORDS) | \
+								 AES_CNT_RDFIFO_DMA_SIZE(AES_DMA_BLOCK_WORDS))
+#define AES_DMA_IN_FLAGS		(NDMA_STARTUP_AES_IN | NDMA_SRC_UPDATE_INC | NDMA_DST_UPDATE_FIXED | \
+								 NDMA_BURST_WORDS(4))
+#define AES_DMA_OUT_FLAGS		(NDMA_STARTUP_AES_OUT | NDMA_SRC_UPDATE_FIXED | NDMA_DST_UPDATE_INC | \
+								 NDMA_BURST_WORDS(4))
+
 #define AES_KEYCNT_WRITE		(1 << 0x7)
 #define AES_KEYNORMAL			0
 #define AES_KEYX				1
@@ -116,7 +133,12 @@ void aes_advctr(void* ctr, uint32_t val, uint32_t mode);
 void aes_change_ctrmode(void* ctr, uint32_t fromMode, uint32_t toMode);
 
 void aes_batch(void* dst, const void* src, uint32_t blockCount);
+void aes_batch_burst(void* dst, const void* src, uint32_t blockCount);
+void aes_batch_dma(void* dst, const void* src, uint32_t blockCount);
 
+void sha_init(uint32_t mode);
+void sha_update(const void* src, uint32_t size);
+void sha_final(void* res, const void* src, uint32_t size);
 void sha(void* res, const void* src, uint32_t size, uint32_t mode);
 
 void rsa_setkey(uint32_t keyslot, const void* mod, const void* exp, uint32_t mode);
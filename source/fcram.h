@@ -28,3 +28,11 @@ extern void *fcram_temp;
 
 // config.c
 #define FCRAM_CONFIG (FCRAM_START + FCRAM_SPACING * 12)
+
+// patch.c
+#define FCRAM_CAKE_CATALOG (FCRAM_START + FCRAM_SPACING * 13)
+#define FCRAM_CAKE_CATALOG_NEW (FCRAM_START + FCRAM_SPACING * 14)
+#define FCRAM_CAKE_JOURNAL (FCRAM_START + FCRAM_SPACING * 15)
+#define FCRAM_SYSMODULE_STAGE (FCRAM_START + FCRAM_SPACING * 16)  // Double size
+#define FCRAM_SYSMODULE_SCRATCH (FCRAM_START + FCRAM_SPACING * 18)  // Double size
+#define FCRAM_PATCH_TABLES (FCRAM_START + FCRAM_SPACING * 20)
@@ -19,12 +19,16 @@
 #include "fatfs/ff.h"
 #include "fatfs/sdmmc/sdmmc.h"
 #include "external/crypto.h"
+#include "keyslot.h"
+#include "ndma.h"
+#include "trace.h"
 #else
 #include <string.h>
 #endif
 
 #include "types.h"
 #ifndef STANDALONE
+// These point at the decrypted FIRM, which may start anywhere in its slot.
 firm_h *firm_orig_loc = (firm_h *)FCRAM_FIRM_ORIG_LOC;
 size_t firm_size = FCRAM_SPACING;
 
@@ -36,27 +40,113 @@ size_t agb_firm_size = FCRAM_SPACING;
 
 static int update_96_keys = 0;
 int save_firm = 0;
+unsigned int firms_attempted = 0;
+
+// Size of the pieces an encrypted FIRM is read and decrypted in.
+// Has to be a multiple of AES_BLOCK_SIZE, and big enough to hold the NCCH header.
+#define FIRM_CHUNK_SIZE 0x40000
+
+// The parts of the NCCH we decrypt, in order. Each one tells us where the next one is.
+enum firm_region {
+    REGION_NCCH_HEADER,
+    REGION_EXEFS_HEADER,
+    REGION_FIRM,
+    REGION_DONE
+};
+
+// Decryption state carried over between chunks.
+struct firm_crypto {
+    uint8_t ncch_iv[AES_BLOCK_SIZE];
+    uint8_t exefs_iv[AES_BLOCK_SIZE];
+    uint32_t ncch_size;
+    uint32_t exefs_offset;
+    uint32_t exefs_size;
+    uint32_t firm_offset;
+    uint32_t firm_size;
+    enum firm_region region;
+    uint32_t region_start;  // Moves forward as the region gets decrypted.
+    uint32_t region_end;
+    uint32_t cbc_end;  // End of the last CBC decrypted range, ncch_iv is valid for it.
+};
+
+// Section hash verification state, fed as the FIRM is being read.
+struct firm_verify {
+    int enabled;
+    firm_h *firm;
+    uint8_t order[4];  // Sections in the order they appear in the file.
+    unsigned int count;
+    unsigned int current;
+    uint32_t hashed;  // Bytes of the current section fed to the SHA engine.
+    int started;
+    struct firm_verified *verified;  // What we know from earlier boots.
+    uint8_t hashes[4][SHA_256_HASH_SIZE];  // What the data actually hashed to.
+};
+
+// Saved next to the FIRM once it passes verification, so later boots can skip it.
+struct firm_verified {
+    uint8_t hashes[4][SHA_256_HASH_SIZE];  // Computed over the sections of the file that was verified.
+    uint8_t arm9bin_hash[SHA_256_HASH_SIZE];  // The ARM9 section once we've decrypted its arm9bin, if we did.
+    uint32_t size;  // Which file that was, so it gets verified again when it changes.
+    uint16_t date;
+    uint16_t time;
+};
 
 #define A9LHBOOT (*(volatile uint8_t *)0x10010000 == 0) // CFG_BOOTENV
 static volatile uint32_t *const arm11_entry = (volatile uint32_t *)0x1FFFFFF8;
 static volatile uint32_t *const arm11_entry2 = (volatile uint32_t *)0x1FFFFFFC;
+#else
+// The standalone patcher keeps a copy of the FIRMs it loaded, see main.c.
+firm_h *firm_orig_loc = NULL;
+firm_h *twl_firm_orig_loc = NULL;
+firm_h *agb_firm_orig_loc = NULL;
 #endif
 
 struct firm_signature *current_firm = NULL;
 struct firm_signature *current_twl_firm = NULL;
 struct firm_signature *current_agb_firm = NULL;
 
-struct firm_signature *get_firm_info(firm_h *firm, struct firm_signature *signatures, enum firm_types firm_type)
+struct firm_signature *get_firm_info(firm_h *firm, enum firm_types firm_type)
 {
-    for (struct firm_signature *signature = signatures; signature->version != 0xFF; signature++) {
-        if (firm_type == TWL_FIRM) {
-            if (memcmp(signature->sig, firm->section[3].hash, 0x10) == 0) {
-                return signature;
-            }
+    struct firm_signature *signatures;
+    unsigned int count;
+    const uint8_t *hash;
+
+    switch (firm_type) {
+        case NATIVE_FIRM:
+            signatures = firm_signatures;
+            count = firm_signatures_count;
+            hash = firm->section[0].hash;
+            break;
+
+        case TWL_FIRM:
+            signatures = twl_firm_signatures;
+            count = twl_firm_signatures_count;
+            hash = firm->section[3].hash;
+            break;
+
+        case AGB_FIRM:
+            signatures = agb_firm_signatures;
+            count = agb_firm_signatures_count;
+            hash = firm->section[0].hash;
+            break;
+
+        default:
+            return NULL;
+    }
+
+    // The tables are sorted at build time, so we can do a binary search.
+    unsigned int low = 0;
+    unsigned int high = count;
+    while (low < high) {
+        unsigned int mid = low + (high - low) / 2;
+        int cmp = memcmp(signatures[mid].sig, hash, sizeof(signatures[mid].sig));
+
+        if (cmp == 0) {
+            return &signatures[mid];
+        } else if (cmp < 0) {
+            low = mid + 1;
         } else {
-            if (memcmp(signature->sig, firm->section[0].hash, 0x10) == 0) {
-                return signature;
-            }
+            high = mid;
         }
     }
 
@@ -71,7 +161,7 @@ void slot0x11key96_init()
     uint8_t key[] = {
         0x42, 0x3F, 0x81, 0x7A, 0x23, 0x52, 0x58, 0x31, 0x6E, 0x75, 0x8E, 0x3A, 0x39, 0x43, 0x2E, 0xD0
     };
-    aes_setkey(0x11, key, AES_KEYNORMAL, AES_INPUT_BE | AES_INPUT_NORMAL);
+    keyslot_set(0x11, key, AES_KEYNORMAL);
 
     // Tell boot_firm it needs to regenerate the keys.
     update_96_keys = 1;
@@ -94,7 +184,7 @@ int dump_firm(void *firm_buffer, const uint8_t firm_id)
     memcpy(nand_ctr, sha_hash, 0x10);
     aes_advctr(nand_ctr, firm_offset / AES_BLOCK_SIZE, AES_INPUT_BE | AES_INPUT_NORMAL);
 
-    aes_use_keyslot(0x06);
+    keyslot_use(0x06);
     aes_setiv(nand_ctr, AES_INPUT_BE | AES_INPUT_NORMAL);
     aes(firm_buffer, firm_buffer, firm_size / AES_BLOCK_SIZE, nand_ctr, AES_CTR_MODE, AES_INPUT_BE | AES_INPUT_NORMAL);
 
@@ -118,22 +208,22 @@ int decrypt_arm9bin(arm9bin_h *header, enum firm_types firm_type, const unsigned
             0x07, 0x29, 0x44, 0x38, 0xF8, 0xC9, 0x75, 0x93, 0xAA, 0x0E, 0x4A, 0xB4, 0xAE, 0x84, 0xC1, 0xD8
         };
 
-        aes_setkey(0x11, slot0x11keyold, AES_KEYNORMAL, AES_INPUT_BE | AES_INPUT_NORMAL);
+        keyslot_set(0x11, slot0x11keyold, AES_KEYNORMAL);
         slot = 0x15;
         encrypted_keyx = header->keyx;
     }
 
-    aes_use_keyslot(0x11);
+    keyslot_use(0x11);
     aes(decrypted_keyx, encrypted_keyx, 1, NULL, AES_ECB_DECRYPT_MODE, 0);
 
-    aes_setkey(slot, decrypted_keyx, AES_KEYX, AES_INPUT_BE | AES_INPUT_NORMAL);
-    aes_setkey(slot, header->keyy, AES_KEYY, AES_INPUT_BE | AES_INPUT_NORMAL);
+    keyslot_set(slot, decrypted_keyx, AES_KEYX);
+    keyslot_set(slot, header->keyy, AES_KEYY);
     aes_setiv(header->ctr, AES_INPUT_BE | AES_INPUT_NORMAL);
 
     void *arm9bin = (uint8_t *)header + 0x800;
     int size = atoi(header->size);
 
-    aes_use_keyslot(slot);
+    keyslot_use(slot);
     aes(arm9bin, arm9bin, size / AES_BLOCK_SIZE, header->ctr, AES_CTR_MODE, AES_INPUT_BE | AES_INPUT_NORMAL);
 
     if (firm_type == NATIVE_FIRM) return *(uint32_t *)arm9bin != ARM9BIN_MAGIC;
@@ -147,7 +237,6 @@ int decrypt_cetk_key(void *key, const void *cetk)
     // I don't need it for anything else atm.
     // Either way, this is the reason for the two checks here at the top.
 
-    static int common_key_y_init = 0;
     uint8_t iv[AES_BLOCK_SIZE] = {0};
 
     uint32_t sigtype = __builtin_bswap32(*(uint32_t *)cetk);
@@ -156,17 +245,13 @@ int decrypt_cetk_key(void *key, const void *cetk)
     ticket_h *ticket = (ticket_h *)(cetk + sizeof(sigtype) + 0x13C);
     if (ticket->ticketCommonKeyYIndex != 1) return 1;
 
-    if (!common_key_y_init) {
-        // From https://github.com/profi200/Project_CTR/blob/master/makerom/pki/prod.h#L19
-        uint8_t common_key_y[AES_BLOCK_SIZE] = {
-            0x0C, 0x76, 0x72, 0x30, 0xF0, 0x99, 0x8F, 0x1C, 0x46, 0x82, 0x82, 0x02, 0xFA, 0xAC, 0xBE, 0x4C
-        };
-
-        aes_setkey(0x3D, common_key_y, AES_KEYY, AES_INPUT_BE | AES_INPUT_NORMAL);
-        common_key_y_init = 1;
-    }
+    // From https://github.com/profi200/Project_CTR/blob/master/makerom/pki/prod.h#L19
+    uint8_t common_key_y[AES_BLOCK_SIZE] = {
+        0x0C, 0x76, 0x72, 0x30, 0xF0, 0x99, 0x8F, 0x1C, 0x46, 0x82, 0x82, 0x02, 0xFA, 0xAC, 0xBE, 0x4C
+    };
 
-    aes_use_keyslot(0x3D);
+    keyslot_set(0x3D, common_key_y, AES_KEYY);
+    keyslot_use(0x3D);
 
     memcpy(iv, ticket->titleID, sizeof(ticket->titleID));
 
@@ -177,115 +262,432 @@ int decrypt_cetk_key(void *key, const void *cetk)
     return 0;
 }
 
-int decrypt_firm_title(firm_h *dest, ncch_h *ncch, size_t *size, void *key)
+int load_firm_key(void *firm_key, char *path_firmkey, char *path_cetk, enum firm_types firm_type)
 {
-    uint8_t firm_iv[16] = {0};
-    uint8_t exefs_key[16] = {0};
-    uint8_t exefs_iv[16] = {0};
+    if (read_file(firm_key, path_firmkey, AES_BLOCK_SIZE) == 0) {
+        print("Loaded FIRM key");
+        return 0;
+    }
 
-    print("Decrypting the NCCH");
-    aes_setkey(0x16, key, AES_KEYNORMAL, AES_INPUT_BE | AES_INPUT_NORMAL);
-    aes_use_keyslot(0x16);
-    aes(ncch, ncch, *size / AES_BLOCK_SIZE, firm_iv, AES_CBC_DECRYPT_MODE, AES_INPUT_BE | AES_INPUT_NORMAL);
+    print("Failed to load FIRM key,\n  will try to create it...");
 
-    if (ncch->magic != NCCH_MAGIC) return 1;
+    if (read_file(fcram_temp, path_cetk, FCRAM_SPACING) != 0) {
+        print("Failed to load CETK");
 
-    memcpy(exefs_key, ncch, 16);
-    ncch_getctr(ncch, exefs_iv, NCCHTYPE_EXEFS);
+        if (firm_type == NATIVE_FIRM) {
+            draw_loading("Failed to load FIRM key or CETK",
+                         "Make sure you have a firmkey.bin or cetk\n"
+                         "  located at " PATH_FIRMKEY "\n"
+                         "  or " PATH_CETK ", respectively.");
+        }
+        return 2;
+    }
+    print("Loaded CETK");
 
-    // Get the exefs offset and size from the NCCH
-    exefs_h *exefs = (exefs_h *)((void *)ncch + ncch->exeFSOffset * MEDIA_UNITS);
-    uint32_t exefs_size = ncch->exeFSSize * MEDIA_UNITS;
+    if (decrypt_cetk_key(firm_key, fcram_temp) != 0) {
+        print("Failed to decrypt the CETK");
+        draw_loading("Failed to decrypt the CETK", "Please make sure the CETK is right.");
+        return 1;
+    }
+    print("Saving FIRM key for future use");
+    write_file(firm_key, path_firmkey, AES_BLOCK_SIZE);
 
-    print("Decrypting the exefs");
-    aes_setkey(0x2C, exefs_key, AES_KEYY, AES_INPUT_BE | AES_INPUT_NORMAL);
-    aes_use_keyslot(0x2C);
-    aes(exefs, exefs, exefs_size / AES_BLOCK_SIZE, exefs_iv, AES_CTR_MODE, AES_INPUT_BE | AES_INPUT_NORMAL);
+    return 0;
+}
 
-    // Get the decrypted FIRM
-    // We assume the firm.bin is always the first file
-    firm_h *firm = (firm_h *)&exefs[1];  // The offset right behind the exefs header; the first file.
-    *size = exefs->fileHeaders[0].size;
+void decrypt_firm_range(ncch_h *ncch, struct firm_crypto *crypto, const uint32_t start, const uint32_t end)
+{
+    void *data = (void *)ncch + start;
 
-    if (firm->magic != FIRM_MAGIC) return 1;
+    // Every CBC block only needs the ciphertext of the one before it as IV,
+    //   so we can start anywhere, as long as that block is still encrypted.
+    if (start != crypto->cbc_end) memcpy(crypto->ncch_iv, data - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
 
-    memcpy(dest, firm, *size);
+    keyslot_use(0x16);
+    aes(data, data, (end - start) / AES_BLOCK_SIZE, crypto->ncch_iv, AES_CBC_DECRYPT_MODE, AES_INPUT_BE | AES_INPUT_NORMAL);
+    crypto->cbc_end = end;
 
+    // The exefs has another CTR layer on top, the counter follows from the offset.
+    if (crypto->region != REGION_NCCH_HEADER) {
+        uint8_t ctr[AES_BLOCK_SIZE];
+        memcpy(ctr, crypto->exefs_iv, AES_BLOCK_SIZE);
+        aes_advctr(ctr, (start - crypto->exefs_offset) / AES_BLOCK_SIZE, AES_INPUT_BE | AES_INPUT_NORMAL);
+
+        keyslot_use(0x2C);
+        aes(data, data, (end - start) / AES_BLOCK_SIZE, ctr, AES_CTR_MODE, AES_INPUT_BE | AES_INPUT_NORMAL);
+    }
+}
+
+// Called once a region is fully decrypted, to find the next one.
+int next_firm_region(ncch_h *ncch, struct firm_crypto *crypto)
+{
+    exefs_h *exefs = (exefs_h *)((void *)ncch + crypto->exefs_offset);
+    uint32_t start, size;
+
+    switch (crypto->region) {
+        case REGION_NCCH_HEADER:
+            if (ncch->magic != NCCH_MAGIC) return 1;
+
+            keyslot_set(0x2C, ncch, AES_KEYY);
+            ncch_getctr(ncch, crypto->exefs_iv, NCCHTYPE_EXEFS);
+
+            crypto->exefs_offset = ncch->exeFSOffset * MEDIA_UNITS;
+            crypto->exefs_size = ncch->exeFSSize * MEDIA_UNITS;
+            if (crypto->exefs_offset < sizeof(ncch_h) || crypto->exefs_size < sizeof(exefs_h)) return 1;
+
+            start = crypto->exefs_offset;
+            size = sizeof(exefs_h);
+            break;
+
+        case REGION_EXEFS_HEADER:
+            // We assume the firm.bin is always the first file
+            crypto->firm_offset = crypto->exefs_offset + sizeof(exefs_h) + exefs->fileHeaders[0].offset;
+            crypto->firm_size = exefs->fileHeaders[0].size;
+            if (crypto->firm_offset % AES_BLOCK_SIZE || crypto->firm_size < sizeof(firm_h) ||
+                    exefs->fileHeaders[0].offset + crypto->firm_size > crypto->exefs_size - sizeof(exefs_h)) {
+                return 1;
+            }
+
+            start = crypto->firm_offset;
+            size = (crypto->firm_size + AES_BLOCK_SIZE - 1) & ~(AES_BLOCK_SIZE - 1);
+            break;
+
+        default:
+            crypto->region = REGION_DONE;
+            return 0;
+    }
+
+    if (start + size > crypto->ncch_size) return 1;
+
+    crypto->region++;
+    crypto->region_start = start;
+    crypto->region_end = start + size;
     return 0;
 }
 
-int decrypt_firm(firm_h *dest, char *path_firmkey, char *path_cetk, size_t *size, enum firm_types firm_type)
+// Decrypts the NCCH header, the exefs header and the FIRM file as far as they've been read,
+//   skipping everything else in the NCCH.
+int decrypt_firm_chunk(ncch_h *ncch, struct firm_crypto *crypto, const uint32_t offset, const uint32_t size)
 {
-    uint8_t firm_key[AES_BLOCK_SIZE];
+    uint32_t available = offset + size;
+
+    if (offset == 0) {
+        crypto->region = REGION_NCCH_HEADER;
+        crypto->region_start = 0;
+        crypto->region_end = sizeof(ncch_h);
+        crypto->cbc_end = 0;
+    }
 
-    // Firmware is likely encrypted. Decrypt.
-    if (read_file(firm_key, path_firmkey, AES_BLOCK_SIZE) != 0) {
-        print("Failed to load FIRM key,\n  will try to create it...");
+    while (crypto->region != REGION_DONE) {
+        uint32_t end = crypto->region_end;
+        if (crypto->region_start >= available) return 0;
+        if (end > available) end = available;
 
-        if (read_file(fcram_temp, path_cetk, FCRAM_SPACING) != 0) {
-            print("Failed to load CETK");
+        decrypt_firm_range(ncch, crypto, crypto->region_start, end);
+        crypto->region_start = end;
 
-            if (firm_type == NATIVE_FIRM) {
-                draw_loading("Failed to load FIRM key or CETK",
-                             "Make sure you have a firmkey.bin or cetk\n"
-                             "  located at " PATH_FIRMKEY "\n"
-                             "  or " PATH_CETK ", respectively.");
-            }
-            return 2;
+        // Wait for the rest of it.
+        if (end < crypto->region_end) return 0;
+
+        if (next_firm_region(ncch, crypto) != 0) return 1;
+    }
+
+    return 0;
+}
+
+int extract_firm_title(firm_h **dest, ncch_h *ncch, struct firm_crypto *crypto, size_t *size)
+{
+    // The decrypted FIRM stays right where it is, inside the exefs.
+    if (crypto->region != REGION_DONE) return 1;
+    firm_h *firm = (firm_h *)((void *)ncch + crypto->firm_offset);
+    if (firm->magic != FIRM_MAGIC) return 1;
+
+    *dest = firm;
+    *size = crypto->firm_size;
+
+    return 0;
+}
+
+// Check if this exact file has passed verification before, and that what we hashed back then
+//   is what the header says it should be.
+int firm_is_verified(firm_h *firm, const struct firm_verified *verified, const FILINFO *fno)
+{
+    if (verified->size != fno->fsize || verified->date != fno->fdate || verified->time != fno->ftime) return 0;
+
+    for (int x = 0; x < 4; x++) {
+        if (firm->section[x].size == 0) continue;
+        if (memcmp(verified->hashes[x], firm->section[x].hash, SHA_256_HASH_SIZE) == 0) continue;
+
+        // The header hash is over the encrypted arm9bin, which we may have saved decrypted already.
+        if (firm->section[x].type == FIRM_TYPE_ARM9 &&
+                memcmp(verified->hashes[x], verified->arm9bin_hash, SHA_256_HASH_SIZE) == 0) {
+            continue;
         }
-        print("Loaded CETK");
+        return 0;
+    }
 
-        if (decrypt_cetk_key(firm_key, fcram_temp) != 0) {
-            print("Failed to decrypt the CETK");
-            draw_loading("Failed to decrypt the CETK", "Please make sure the CETK is right.");
-            return 1;
+    return 1;
+}
+
+// Remember the hashes of the file at path, after it's been verified or rewritten by us.
+void firm_set_verified(struct firm_verified *verified, char *path, char *path_verified)
+{
+    FILINFO fno;
+
+    if (f_stat(path, &fno) != FR_OK) return;
+    verified->size = fno.fsize;
+    verified->date = fno.fdate;
+    verified->time = fno.ftime;
+
+    write_file(verified, path_verified, sizeof(*verified));
+}
+
+int verify_firm_init(struct firm_verify *verify, firm_h *firm, struct firm_verified *verified)
+{
+    verify->firm = firm;
+    verify->verified = verified;
+    memset(verify->hashes, 0, sizeof(verify->hashes));
+    verify->count = 0;
+    verify->current = 0;
+    verify->hashed = 0;
+    verify->started = 0;
+
+    // Sort the existing sections by their offset, so we can hash them in a single pass.
+    for (int x = 0; x < 4; x++) {
+        firm_section_h *section = &firm->section[x];
+        if (section->size == 0) continue;
+        if (section->offset + section->size < section->offset) return 1;
+
+        unsigned int y;
+        for (y = verify->count; y > 0 && firm->section[verify->order[y - 1]].offset > section->offset; y--) {
+            verify->order[y] = verify->order[y - 1];
         }
-        print("Saving FIRM key for future use");
-        write_file(firm_key, path_firmkey, AES_BLOCK_SIZE);
-    } else {
-        print("Loaded FIRM key");
+        verify->order[y] = x;
+        verify->count++;
     }
 
-    print("Decrypting FIRM");
-    if (decrypt_firm_title(dest, (void *)dest, size, firm_key) != 0) {
-        print("Failed to decrypt the firmware");
-        draw_loading("Failed to decrypt the firmware",
-                     "Please double check your firmware and\n"
-                     "  firmkey/cetk are right.");
-        return 1;
+    // Overlapping sections can't be hashed in one go.
+    for (unsigned int x = 1; x < verify->count; x++) {
+        firm_section_h *prev = &firm->section[verify->order[x - 1]];
+        if (prev->offset + prev->size > firm->section[verify->order[x]].offset) return 1;
     }
+
     return 0;
 }
 
-int load_firm(firm_h *dest, char *path, char *path_firmkey, char *path_cetk, size_t *size, struct firm_signature *signatures, struct firm_signature **current, enum firm_types firm_type)
+// Whether the arm9bin in an ARM9 section is in its decrypted form, which the header hash isn't over.
+static int arm9bin_decrypted(const firm_h *firm, const firm_section_h *section)
 {
-    struct firm_signature *firm_current = NULL;
+    if (section->type != FIRM_TYPE_ARM9 || section->size < 0x800 + sizeof(uint32_t)) return 0;
+
+    uint32_t magic = *(uint32_t *)((uintptr_t)firm + section->offset + 0x800);
+    return magic == ARM9BIN_MAGIC || magic == LGY_ARM9BIN_MAGIC;
+}
+
+int verify_firm_chunk(struct firm_verify *verify, const uint32_t available)
+{
+    while (verify->current < verify->count) {
+        firm_section_h *section = &verify->firm->section[verify->order[verify->current]];
+        void *data = (void *)verify->firm + section->offset + verify->hashed;
+
+        // Wait until this section starts arriving.
+        if (available <= section->offset) return 0;
+
+        if (!verify->started) {
+            sha_init(SHA_256_MODE);
+            verify->started = 1;
+        }
+
+        if (available < section->offset + section->size) {
+            // Feed whatever we have, and wait for the rest.
+            uint32_t size = available - section->offset - verify->hashed;
+            sha_update(data, size);
+            verify->hashed += size;
+            return 0;
+        }
+
+        uint8_t *hash = verify->hashes[verify->order[verify->current]];
+        sha_final(hash, data, section->size - verify->hashed);
+        if (memcmp(hash, section->hash, SHA_256_HASH_SIZE) != 0) {
+            // The hash is over the encrypted arm9bin, which may have been saved decrypted already.
+            // If we did that, it has to be exactly what we decrypted back then.
+            if (section->type != FIRM_TYPE_ARM9) return 1;
+
+            if (memcmp(hash, verify->verified->arm9bin_hash, SHA_256_HASH_SIZE) == 0) {
+                print("ARM9 FIRM binary was decrypted by us");
+            } else if (arm9bin_decrypted(verify->firm, section)) {
+                // Something else decrypted it, so there's nothing to check it against.
+                // Take it as it is, and notice if it changes from now on.
+                print("Warning: ARM9 FIRM binary was\n  decrypted elsewhere, can't verify it");
+                memcpy(verify->verified->arm9bin_hash, hash, SHA_256_HASH_SIZE);
+            } else {
+                return 1;
+            }
+        }
+
+        verify->current++;
+        verify->hashed = 0;
+        verify->started = 0;
+    }
+
+    return 0;
+}
+
+int read_firm(void *slot, firm_h **dest, char *path, char *path_firmkey, char *path_cetk, char *path_verified, struct firm_verified *verified, size_t *size, enum firm_types firm_type, int *decrypted)
+{
+    FRESULT fr;
+    FIL handle;
+    unsigned int bytes_read = 0;
+    struct firm_crypto crypto = {0};
+    struct firm_verify verify = {0};
+    uint32_t firm_start = 0;
+    int encrypted = 0;
     int status = 0;
-    int firmware_changed = 0;
 
-    if (read_file(dest, path, *size) != 0) {
-        print("Failed to load FIRM");
+    // What we know about this file from earlier boots.
+    FILINFO fno;
+    memset(verified, 0, sizeof(*verified));
+    read_file(verified, path_verified, sizeof(*verified));
+
+    fr = f_stat(path, &fno);
+    if (fr != FR_OK) goto error_read;
+
+    fr = f_open(&handle, path, FA_READ);
+    if (fr != FR_OK) goto error_read;
+
+    uint32_t total = f_size(&handle);
+    if (total > *size) total = *size;
+    if (total < sizeof(firm_h)) goto error_read;
+    crypto.ncch_size = total;
+
+    // Read the file in chunks, decrypting every chunk as soon as it arrives,
+    //   instead of reading everything first and going over it again afterwards.
+    // Both the SD driver and the AES engine are polled by the CPU, so this only interleaves them,
+    //   it doesn't overlap them. It keeps the chunk in cache; see standalone_patcher/firm_load_bench.c.
+    for (uint32_t offset = 0; offset < total; offset += bytes_read) {
+        uint32_t chunk = total - offset;
+        if (encrypted || verify.enabled || offset == 0) {
+            if (chunk > FIRM_CHUNK_SIZE) chunk = FIRM_CHUNK_SIZE;
+        }
 
-        // Only whine about this if it's NATIVE_FIRM, which is important.
-        if (firm_type == NATIVE_FIRM) {
-            draw_loading("Failed to load FIRM", "Make sure the encrypted FIRM is\n  located at " PATH_FIRMWARE);
+        fr = f_read(&handle, slot + offset, chunk, &bytes_read);
+        if (fr != FR_OK || bytes_read != chunk) goto error_read;
+
+        if (offset == 0) {
+            print("Loaded FIRM");
+
+            // Check if the FIRM is encrypted.
+            if (((firm_h *)slot)->magic == FIRM_MAGIC) {
+                print("FIRM seems not encrypted");
+            } else {
+                uint8_t firm_key[AES_BLOCK_SIZE];
+
+                status = load_firm_key(firm_key, path_firmkey, path_cetk, firm_type);
+                if (status != 0) goto error;
+
+                print("Decrypting FIRM");
+                keyslot_set(0x16, firm_key, AES_KEYNORMAL);
+                encrypted = 1;
+            }
         }
-        return 2;
+
+        if (encrypted) {
+            unsigned int span = trace_begin("decrypt_firm");
+            status = decrypt_firm_chunk((ncch_h *)slot, &crypto, offset, bytes_read);
+            trace_end(span);
+            if (status != 0) goto error_decrypt;
+        }
+
+        if (offset == 0) {
+            // Once the FIRM header is there, we can start checking the section hashes.
+            if (encrypted) {
+                if (crypto.region < REGION_FIRM) goto error_decrypt;
+                firm_start = crypto.firm_offset;
+            }
+            firm_h *firm = (firm_h *)(slot + firm_start);
+
+            if (firm_start + sizeof(firm_h) > bytes_read || firm->magic != FIRM_MAGIC) goto error_decrypt;
+
+            if (!firm_is_verified(firm, verified, &fno)) {
+                print("Verifying FIRM");
+                if (verify_firm_init(&verify, firm, verified) != 0) goto error_verify;
+                verify.enabled = 1;
+            }
+        }
+
+        // Hash whatever part of the FIRM we have right now, while it's still in the cache.
+        if (verify.enabled && offset + bytes_read > firm_start) {
+            unsigned int span = trace_begin("verify_firm");
+            status = verify_firm_chunk(&verify, offset + bytes_read - firm_start);
+            trace_end(span);
+            if (status != 0) goto error_verify;
+        }
+
+        // Whatever comes after the FIRM file in the NCCH is of no use to us.
+        if (encrypted && crypto.region == REGION_DONE) break;
     }
-    print("Loaded FIRM");
 
-    // Check and decrypt FIRM if it is encrypted.
-    if (dest->magic != FIRM_MAGIC) {
-        status = decrypt_firm(dest, path_firmkey, path_cetk, size, firm_type);
-        if (status != 0)
-            return status;
-        firmware_changed = 1; // Decryption performed.
+    f_close(&handle);
+
+    if (verify.enabled) {
+        // All sections should've been fully hashed by now.
+        if (verify.current < verify.count) goto error_verify;
+        memcpy(verified->hashes, verify.hashes, sizeof(verified->hashes));
+        firm_set_verified(verified, path, path_verified);
+    }
+
+    if (encrypted) {
+        if (extract_firm_title(dest, (ncch_h *)slot, &crypto, size) != 0) goto error_decrypt;
+        *decrypted = 1;
     } else {
-        print("FIRM seems not encrypted");
+        *dest = (firm_h *)slot;
     }
 
+    return 0;
+
+error_read:
+    print("Failed to load FIRM");
+
+    // Only whine about this if it's NATIVE_FIRM, which is important.
+    if (firm_type == NATIVE_FIRM) {
+        draw_loading("Failed to load FIRM", "Make sure the encrypted FIRM is\n  located at " PATH_FIRMWARE);
+    }
+    status = 2;
+    goto error;
+
+error_decrypt:
+    print("Failed to decrypt the firmware");
+    draw_loading("Failed to decrypt the firmware",
+                 "Please double check your firmware and\n"
+                 "  firmkey/cetk are right.");
+    status = 1;
+    goto error;
+
+error_verify:
+    print("FIRM verification failed");
+    draw_loading("FIRM verification failed",
+                 "The section hashes of your firmware don't match.\n"
+                 "It's probably corrupted, please dump it again.");
+    status = 1;
+
+error:
+    f_close(&handle);
+    return status;
+}
+
+int load_firm(void *slot, firm_h **dest, char *path, char *path_firmkey, char *path_cetk, char *path_verified, size_t *size, struct firm_signature **current, enum firm_types firm_type)
+{
+    struct firm_signature *firm_current = NULL;
+    struct firm_verified verified;
+    int status = 0;
+    int firmware_changed = 0;
+
+    status = read_firm(slot, dest, path, path_firmkey, path_cetk, path_verified, &verified, size, firm_type, &firmware_changed);
+    if (status != 0) return status;
+    firm_h *firm = *dest;
+
     // Determine firmware version
-    firm_current = get_firm_info(dest, signatures, firm_type);
+    firm_current = get_firm_info(firm, firm_type);
 
     if (!firm_current) {
         print("Couldn't determine firmware version");
@@ -294,7 +696,7 @@ int load_firm(firm_h *dest, char *path, char *path_firmkey, char *path_cetk, siz
                      "  most probably not supported by Cakes.\n"
                      "Dumping it to your SD card:\n"
                      "  " PATH_UNSUPPORTED_FIRMWARE);
-        write_file(dest, PATH_UNSUPPORTED_FIRMWARE, *size);
+        write_file(firm, PATH_UNSUPPORTED_FIRMWARE, *size);
         print("Dumped unsupported firmware");
         return 1;
     }
@@ -302,12 +704,12 @@ int load_firm(firm_h *dest, char *path, char *path_firmkey, char *path_cetk, siz
     // The N3DS firm has an additional encryption layer for ARM9
     if (firm_current->console == console_n3ds) {
         // Look for the arm9 section
-        for (firm_section_h *section = dest->section;
-                section < dest->section + 4; section++) {
+        for (firm_section_h *section = firm->section;
+                section < firm->section + 4; section++) {
             if (section->type == FIRM_TYPE_ARM9) {
                 // Check whether the arm9bin is encrypted.
                 int arm9bin_iscrypt = 0;
-                uint32_t magic = *(uint32_t*)((uintptr_t)dest + section->offset + 0x800);
+                uint32_t magic = *(uint32_t*)((uintptr_t)firm + section->offset + 0x800);
                 if (firm_type == NATIVE_FIRM)
                     arm9bin_iscrypt = (magic != ARM9BIN_MAGIC);
                 else if (firm_type == AGB_FIRM || firm_type == TWL_FIRM)
@@ -315,8 +717,11 @@ int load_firm(firm_h *dest, char *path, char *path_firmkey, char *path_cetk, siz
 
                 if (arm9bin_iscrypt) {
                     // Decrypt the arm9bin.
-                    if (decrypt_arm9bin((arm9bin_h *)((uintptr_t)dest + section->offset),
-                                firm_type, firm_current->version) != 0) {
+                    unsigned int span = trace_begin("decrypt_arm9bin");
+                    status = decrypt_arm9bin((arm9bin_h *)((uintptr_t)firm + section->offset),
+                                firm_type, firm_current->version);
+                    trace_end(span);
+                    if (status != 0) {
                         print("Couldn't decrypt ARM9 FIRM binary");
                         draw_loading("Couldn't decrypt ARM9 FIRM binary",
                                      "Double-check you've got the right firmware.bin.\n"
@@ -324,6 +729,10 @@ int load_firm(firm_h *dest, char *path, char *path_firmkey, char *path_cetk, siz
                         return 1;
                     }
                     firmware_changed = 1; // Decryption of arm9bin performed.
+
+                    // This is what the section will hash to from now on, instead of what the header says.
+                    sha(verified.arm9bin_hash, (void *)firm + section->offset, section->size, SHA_256_MODE);
+                    memcpy(verified.hashes[section - firm->section], verified.arm9bin_hash, SHA_256_HASH_SIZE);
                 } else {
                     print("ARM9 FIRM binary seems not encrypted");
                     if (firm_type == NATIVE_FIRM && firm_current->version > 0x0F) {
@@ -340,7 +749,8 @@ int load_firm(firm_h *dest, char *path, char *path_firmkey, char *path_cetk, siz
     // Save firmware.bin if decryption was done.
     if (firmware_changed) {
         print("Saving decrypted FIRM");
-        write_file(dest, path, *size);
+        write_file(firm, path, *size);
+        firm_set_verified(&verified, path, path_verified);
     }
 
     if (firm_current->console == console_n3ds) {
@@ -348,10 +758,10 @@ int load_firm(firm_h *dest, char *path, char *path_firmkey, char *path_cetk, siz
 
         // Patch the entrypoint to skip arm9loader
         if (firm_type == NATIVE_FIRM) {
-            dest->arm9_entry = 0x0801B01C;
+            firm->arm9_entry = 0x0801B01C;
         } else if (firm_type == TWL_FIRM ||
                 firm_type == AGB_FIRM) {
-            dest->arm9_entry = 0x0801301C;
+            firm->arm9_entry = 0x0801301C;
         }
         // The entrypoints seem to be the same across different FIRM versions,
         //  so we don't change them.
@@ -377,6 +787,7 @@ void __attribute__((naked)) disable_lcds()
 
 void boot_firm()
 {
+    unsigned int span = trace_begin("boot_firm");
     print("Booting FIRM...");
 
     // Set up the keys needed to boot a few firmwares, due to them being unset, depending on which firmware you're booting from.
@@ -393,35 +804,42 @@ void boot_firm()
             keydata = (void *)((uintptr_t)firm_loc + firm_loc->section[2].offset + 0x8A214);
         } else {
             draw_message("Welp.", "someone forgot to update the keydata again. Please yell at them.");
+            trace_end(span);
             return;
         }
 
         slot0x11key96_init();
-        aes_use_keyslot(0x11);
+        keyslot_use(0x11);
         uint8_t keyx[AES_BLOCK_SIZE];
         for (int slot = 0x19; slot < 0x20; slot++) {
             aes(keyx, keydata, 1, NULL, AES_ECB_DECRYPT_MODE, 0);
-            aes_setkey(slot, keyx, AES_KEYX, AES_INPUT_BE | AES_INPUT_NORMAL);
+            keyslot_set(slot, keyx, AES_KEYX);
             *(uint8_t *)(keydata + 0xF) += 1;
         }
 
         print("Updated keyX keyslots");
     }
 
+    // Every copy runs in the background while we look up the next one.
     struct memory_header *memory = (void *)(memory_loc + 1);
     print("Started copying");
     while ((uintptr_t)memory < (uintptr_t)memory_loc + *memory_loc) {
-        memcpy((void *)memory->location, memory + 1, memory->size);
+        ndma_copy_start((void *)memory->location, memory + 1, memory->size);
         memory = (void *)((uintptr_t)(memory + 1) + memory->size);
     }
     print("Copied memory");
 
     for (firm_section_h *section = firm_loc->section;
             section < firm_loc->section + 4 && section->address != 0; section++) {
-        memcpy((void *)section->address, (void *)firm_loc + section->offset, section->size);
+        ndma_copy_start((void *)section->address, (void *)firm_loc + section->offset, section->size);
     }
+    ndma_copy_wait();
     print("Copied FIRM");
 
+    // Last chance to save the boot trace, right before we jump.
+    keyslot_trace();
+    trace_flush();
+
     *arm11_entry = (uint32_t)disable_lcds;
     *arm11_entry2 = (uint32_t)disable_lcds;
     while (*arm11_entry);  // Make sure it jumped there correctly before changing it.
@@ -439,29 +857,83 @@ int load_firms()
 
     print("Loading NATIVE_FIRM...");
     draw_loading(title, "Loading NATIVE_FIRM...");
-    if (load_firm(firm_orig_loc, PATH_FIRMWARE, PATH_FIRMKEY, PATH_CETK, &firm_size, firm_signatures, &current_firm, NATIVE_FIRM) != 0) {
+    firms_attempted |= 1 << NATIVE_FIRM;
+    unsigned int span = trace_begin("load_firm");
+    int status = load_firm((void *)FCRAM_FIRM_ORIG_LOC, &firm_orig_loc, PATH_FIRMWARE, PATH_FIRMKEY, PATH_CETK, PATH_FIRMWARE_VERIFIED, &firm_size, &current_firm, NATIVE_FIRM);
+    trace_end(span);
+    if (status != 0) {
         draw_string(screen_top_left, "FIRM that failed: NATIVE_FIRM",
                 0, SCREEN_TOP_HEIGHT - MARGIN_VERT - SPACING_VERT, COLOR_NEUTRAL);
         return 1;
     }
 
-    print("Loading TWL_FIRM...");
-    draw_loading(title, "Loading TWL_FIRM...");
-    if (load_firm(twl_firm_orig_loc, PATH_TWL_FIRMWARE, PATH_TWL_FIRMKEY, PATH_TWL_CETK, &twl_firm_size, twl_firm_signatures, &current_twl_firm, TWL_FIRM) == 1) {
-        draw_string(screen_top_left, "FIRM that failed: TWL_FIRM",
-                0, SCREEN_TOP_HEIGHT - MARGIN_VERT - SPACING_VERT, COLOR_NEUTRAL);
-        return 1;
+    // TWL_FIRM and AGB_FIRM are only loaded once a selected cake needs them.
+    return 0;
+}
+
+// Check if a FIRM we haven't loaded yet is there, by only reading its header.
+// Returns 1 if the file is missing, 0 otherwise. *info is NULL if we can't tell the version
+//   before decrypting it, which only happens the first time it's loaded.
+int peek_firm(enum firm_types firm_type, struct firm_signature **info)
+{
+    static char *const paths[] = {PATH_FIRMWARE, PATH_TWL_FIRMWARE, PATH_AGB_FIRMWARE};
+    static unsigned int peeked = 0;
+    static unsigned int missing = 0;
+    static struct firm_signature *peeked_info[AGB_FIRM + 1];
+
+    if (firm_type > AGB_FIRM) return 1;
+
+    if (!(peeked & (1 << firm_type))) {
+        firm_h header;
+
+        peeked |= 1 << firm_type;
+        peeked_info[firm_type] = NULL;
+        if (read_file(&header, paths[firm_type], sizeof(header)) != 0) {
+            missing |= 1 << firm_type;
+        } else if (header.magic == FIRM_MAGIC) {
+            peeked_info[firm_type] = get_firm_info(&header, firm_type);
+        }
     }
 
-    print("Loading AGB_FIRM...");
-    draw_loading(title, "Loading AGB_FIRM...");
-    if (load_firm(agb_firm_orig_loc, PATH_AGB_FIRMWARE, PATH_AGB_FIRMKEY, PATH_AGB_CETK, &agb_firm_size, agb_firm_signatures, &current_agb_firm, AGB_FIRM) == 1) {
-        draw_string(screen_top_left, "FIRM that failed: AGB_FIRM",
-                0, SCREEN_TOP_HEIGHT - MARGIN_VERT - SPACING_VERT, COLOR_NEUTRAL);
-        return 1;
+    *info = peeked_info[firm_type];
+    return (missing >> firm_type) & 1;
+}
+
+// The cakes that need a FIRM that fails to load are skipped afterwards, see patch_firm_all().
+void load_legacy_firms(const unsigned int firm_types)
+{
+    const char *title = "Loading firm";
+    int status;
+
+    if ((firm_types & (1 << TWL_FIRM)) && !(firms_attempted & (1 << TWL_FIRM))) {
+        print("Loading TWL_FIRM...");
+        draw_loading(title, "Loading TWL_FIRM...");
+        firms_attempted |= 1 << TWL_FIRM;
+        unsigned int span = trace_begin("load_firm");
+        status = load_firm((void *)FCRAM_TWL_FIRM_ORIG_LOC, &twl_firm_orig_loc, PATH_TWL_FIRMWARE, PATH_TWL_FIRMKEY, PATH_TWL_CETK, PATH_TWL_FIRMWARE_VERIFIED, &twl_firm_size, &current_twl_firm, TWL_FIRM);
+        trace_end(span);
+        if (status == 1) {
+            draw_string(screen_top_left, "FIRM that failed: TWL_FIRM",
+                    0, SCREEN_TOP_HEIGHT - MARGIN_VERT - SPACING_VERT, COLOR_NEUTRAL);
+        } else if (status == 2) {
+            print("TWL_FIRM not found");
+        }
     }
 
-    return 0;
+    if ((firm_types & (1 << AGB_FIRM)) && !(firms_attempted & (1 << AGB_FIRM))) {
+        print("Loading AGB_FIRM...");
+        draw_loading(title, "Loading AGB_FIRM...");
+        firms_attempted |= 1 << AGB_FIRM;
+        unsigned int span = trace_begin("load_firm");
+        status = load_firm((void *)FCRAM_AGB_FIRM_ORIG_LOC, &agb_firm_orig_loc, PATH_AGB_FIRMWARE, PATH_AGB_FIRMKEY, PATH_AGB_CETK, PATH_AGB_FIRMWARE_VERIFIED, &agb_firm_size, &current_agb_firm, AGB_FIRM);
+        trace_end(span);
+        if (status == 1) {
+            draw_string(screen_top_left, "FIRM that failed: AGB_FIRM",
+                    0, SCREEN_TOP_HEIGHT - MARGIN_VERT - SPACING_VERT, COLOR_NEUTRAL);
+        } else if (status == 2) {
+            print("AGB_FIRM not found");
+        }
+    }
 }
 
 void boot_cfw()
@@ -469,15 +941,18 @@ void boot_cfw()
     const char *title = "Booting CFW";
 
     draw_loading(title, "Patching...");
-    if (patch_firm_all() != 0) return;
+    unsigned int span = trace_begin("patch_firm_all");
+    int status = patch_firm_all();
+    trace_end(span);
+    if (status != 0) return;
 
     // Only save the firm if that option is required (or it's needed for autoboot),
     //   and either the patches have been modified, or the file doesn't exist.
-    if (save_firm || (config->autoboot_enabled &&
+    if (save_firm || patches_save_firm || (config->autoboot_enabled &&
             (patches_modified || f_stat(PATH_PATCHED_FIRMWARE, NULL) != 0))) {
         draw_loading(title, "Saving NATIVE_FIRM...");
         print("Saving patched NATIVE_FIRM");
-        if (write_file(firm_loc, PATH_PATCHED_FIRMWARE, firm_size) != 0) {
+        if (write_file(firm_loc, PATH_PATCHED_FIRMWARE, firm_end(firm_loc, firm_size)) != 0) {
             draw_message("Failed to save the patched FIRM",
                     "One or more patches you selected requires this.\n"
                     "But, for some reason, we failed to write it.");
@@ -485,7 +960,7 @@ void boot_cfw()
         }
     }
 
-    if (save_firm || (config->autoboot_enabled &&
+    if (save_firm || patches_save_firm || (config->autoboot_enabled &&
             (patches_modified || f_stat(PATH_MEMORY, NULL) != 0))) {
         draw_loading(title, "Saving Memory...");
         print("Saving memory");
@@ -495,19 +970,20 @@ void boot_cfw()
         }
     }
 
-    if (current_twl_firm && (save_firm || patches_modified || f_stat(PATH_PATCHED_TWL_FIRMWARE, NULL) != 0)) {
+    // Leave the patched legacy FIRMs alone if none of the selected cakes needed them.
+    if (current_twl_firm && (firms_needed & (1 << TWL_FIRM)) && (save_firm || patches_save_firm || patches_modified || f_stat(PATH_PATCHED_TWL_FIRMWARE, NULL) != 0)) {
         draw_loading(title, "Saving TWL_FIRM...");
         print("Saving patched TWL_FIRM");
-        if (write_file(twl_firm_loc, PATH_PATCHED_TWL_FIRMWARE, twl_firm_size) != 0) {
+        if (write_file(twl_firm_loc, PATH_PATCHED_TWL_FIRMWARE, firm_end(twl_firm_loc, twl_firm_size)) != 0) {
             draw_message("Failed to save the patched FIRM", "For some reason, we haven't been able to write to the SD card.");
             return;
         }
     }
 
-    if (current_agb_firm && (save_firm || patches_modified || f_stat(PATH_PATCHED_AGB_FIRMWARE, NULL) != 0)) {
+    if (current_agb_firm && (firms_needed & (1 << AGB_FIRM)) && (save_firm || patches_save_firm || patches_modified || f_stat(PATH_PATCHED_AGB_FIRMWARE, NULL) != 0)) {
         draw_loading(title, "Saving AGB_FIRM...");
         print("Saving patched AGB_FIRM");
-        if (write_file(agb_firm_loc, PATH_PATCHED_AGB_FIRMWARE, agb_firm_size) != 0) {
+        if (write_file(agb_firm_loc, PATH_PATCHED_AGB_FIRMWARE, firm_end(agb_firm_loc, agb_firm_size)) != 0) {
             draw_message("Failed to save the patched FIRM", "For some reason, we haven't been able to write to the SD card.");
             return;
         }
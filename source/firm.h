@@ -6,7 +6,9 @@
 #include "headers.h"
 #include "firm_signatures.h"
 
+#ifndef STANDALONE
 #include "types.h"
+#endif
 
 extern firm_h *firm_orig_loc;
 extern size_t firm_size;
@@ -18,11 +20,16 @@ extern firm_h *agb_firm_orig_loc;
 extern size_t agb_firm_size;
 extern struct firm_signature *current_agb_firm;
 extern int save_firm;
+extern unsigned int firms_attempted;
 
-struct firm_signature *get_firm_info(firm_h *firm, struct firm_signature *signatures, enum firm_types firm_type);
+struct firm_signature *get_firm_info(firm_h *firm, enum firm_types firm_type);
 void slot0x11key96_init();
 int load_firms();
+int peek_firm(enum firm_types firm_type, struct firm_signature **info);
+void load_legacy_firms(const unsigned int firm_types);
 void boot_firm();
 void boot_cfw();
 
+#ifndef STANDALONE
 void loadHomebrewFirm(u32 pressed);
+#endif
@@ -1,284 +0,0 @@
-#include "firm_signatures.h"
-
-// We use the firm's section 0's hash to identify the version
-struct firm_signature firm_signatures[] = {
-    {
-        .sig = {0xD6, 0xA3, 0x64, 0xC1, 0x67, 0x69, 0x0D, 0x15, 0x48, 0x16, 0xA8, 0x9A, 0x04, 0x8D, 0xA4, 0xD7},
-        .version = 0x00,
-        .version_string = "1.0.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x4F, 0x99, 0x96, 0xE0, 0xF7, 0x7B, 0x3E, 0xB8, 0xD7, 0xD9, 0x78, 0xE8, 0x07, 0xBA, 0xCD, 0x06},
-        .version = 0x02,
-        .version_string = "1.1.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0xC5, 0xFB, 0xFE, 0x66, 0xB0, 0x40, 0x7E, 0x26, 0xF0, 0x23, 0xD9, 0xA9, 0xA0, 0x4C, 0x2C, 0x55},
-        .version = 0x09,
-        .version_string = "2.0.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0xA9, 0x77, 0x27, 0x94, 0xB9, 0x74, 0xD4, 0xA0, 0xDC, 0xC4, 0xCD, 0xB5, 0x39, 0x75, 0x7C, 0xE1},
-        .version = 0x0B,
-        .version_string = "2.1.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x5B, 0x33, 0x27, 0x66, 0x02, 0xF8, 0x0F, 0x69, 0xE1, 0xD6, 0x56, 0x53, 0xCB, 0xB6, 0xE5, 0xE1},
-        .version = 0x0F,
-        .version_string = "2.2.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0xBF, 0x0D, 0x6A, 0x2C, 0xEA, 0x27, 0x5D, 0x7A, 0x25, 0x0E, 0x8D, 0x39, 0x98, 0xCD, 0xFC, 0x4F},
-        .version = 0x18,
-        .version_string = "3.0.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x06, 0x57, 0xC7, 0x79, 0x37, 0xA5, 0x40, 0x6D, 0x02, 0xF4, 0xC5, 0xE2, 0xD0, 0x17, 0x78, 0xF0},
-        .version = 0x1D,
-        .version_string = "4.0.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0xEE, 0xE2, 0x81, 0x2E, 0xB9, 0x10, 0x0D, 0x03, 0xFE, 0xA2, 0x3F, 0x44, 0xB5, 0x1C, 0xB3, 0x5E},
-        .version = 0x1F,
-        .version_string = "4.1.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x12, 0x76, 0x4B, 0xFF, 0xB5, 0x18, 0xFB, 0xB2, 0xF7, 0xEB, 0xC4, 0xFC, 0x0C, 0xD3, 0x87, 0x64},
-        .version = 0x25,
-        .version_string = "5.0.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x57, 0x89, 0x78, 0x53, 0xE8, 0x2B, 0xA8, 0xC1, 0xD0, 0xC1, 0x1E, 0x9F, 0xD7, 0x8E, 0xB4, 0xAB},
-        .version = 0x26,
-        .version_string = "5.1.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x3E, 0xC0, 0x99, 0x34, 0x9C, 0xFF, 0xC3, 0xCB, 0x2C, 0x94, 0x41, 0x1C, 0x2A, 0xB4, 0xE7, 0x75},
-        .version = 0x29,
-        .version_string = "6.0.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x8C, 0x29, 0xDA, 0x7B, 0xB5, 0x5F, 0xFE, 0x44, 0x1F, 0x66, 0x79, 0x70, 0x8E, 0xE4, 0x42, 0xE3},
-        .version = 0x2A,
-        .version_string = "6.1.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0xE9, 0x00, 0x70, 0x20, 0x06, 0x20, 0xBA, 0x25, 0x6C, 0x57, 0x1A, 0xB2, 0xF8, 0xC9, 0xBA, 0xD8},
-        .version = 0x2E,
-        .version_string = "7.0.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x1D, 0x96, 0x80, 0xD9, 0x0A, 0xA9, 0xDB, 0xE8, 0x29, 0x77, 0xCB, 0x7D, 0x90, 0x55, 0xB7, 0xF9},
-        .version = 0x30,
-        .version_string = "7.2.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x3B, 0x61, 0x2E, 0xBA, 0x42, 0xAE, 0x24, 0x46, 0xAD, 0x60, 0x2F, 0x7B, 0x52, 0x16, 0x82, 0x91},
-        .version = 0x37,
-        .version_string = "8.0.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x3F, 0xBF, 0x14, 0x06, 0x33, 0x77, 0x82, 0xDE, 0xB2, 0x68, 0x83, 0x01, 0x6B, 0x1A, 0x71, 0x69},
-        .version = 0x38,
-        .version_string = "9.0.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x7E, 0x87, 0x15, 0x83, 0x08, 0x9E, 0x7B, 0xF8, 0x79, 0x46, 0xEE, 0x15, 0x79, 0x67, 0xCB, 0x3F},
-        .version = 0x3F,
-        .version_string = "9.3.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0xE4, 0x9D, 0x4A, 0x11, 0xCE, 0x12, 0x3B, 0xAB, 0xDE, 0x08, 0xE3, 0x27, 0x90, 0x9D, 0xDB, 0x28},
-        .version = 0x40,
-        .version_string = "9.5.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x5C, 0x6A, 0x51, 0xF3, 0x79, 0x4D, 0x21, 0x91, 0x0B, 0xBB, 0xFD, 0x17, 0x7B, 0x72, 0x6B, 0x59},
-        .version = 0x49,
-        .version_string = "9.6.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x16, 0x3B, 0x88, 0xD1, 0x7D, 0x7C, 0x13, 0x19, 0xB5, 0x8C, 0x7D, 0x59, 0x16, 0x81, 0x02, 0x03},
-        .version = 0x4B,
-        .version_string = "10.0.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x75, 0xBF, 0x76, 0x6C, 0x39, 0xCC, 0x81, 0x71, 0x3A, 0x5E, 0xB1, 0xFC, 0xCF, 0xB3, 0x8D, 0x78},
-        .version = 0x4C,
-        .version_string = "10.2.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0xF5, 0x7E, 0xC3, 0x86, 0x1F, 0x8D, 0x8E, 0xFB, 0x44, 0x61, 0xF3, 0x16, 0x51, 0x0A, 0x57, 0x7D},
-        .version = 0x50,
-        .version_string = "10.4.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0xE9, 0xAD, 0x74, 0x9D, 0x46, 0x9C, 0x9C, 0xF4, 0x96, 0x9E, 0x1A, 0x7A, 0xDF, 0x40, 0x2A, 0x82},
-        .version = 0x52,
-        .version_string = "11.0.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0xB4, 0xBE, 0xE0, 0xFD, 0xE5, 0xC8, 0x0B, 0x52, 0x36, 0x6D, 0x0A, 0xAF, 0x46, 0x8F, 0x4B, 0x0F},
-        .version = 0x56,
-        .version_string = "11.1.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0xEC, 0x94, 0xD7, 0x6C, 0x40, 0xCB, 0x4C, 0xE9, 0x82, 0x47, 0xF4, 0xAF, 0x55, 0xCF, 0x22, 0x52},
-        .version = 0x58,
-        .version_string = "11.2.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x87, 0xF8, 0x6E, 0x21, 0xBF, 0xF2, 0x8C, 0x66, 0x55, 0xC5, 0xE1, 0x51, 0x1A, 0xAE, 0x51, 0x29},
-        .version = 0x5C,
-        .version_string = "11.3.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x47, 0x6B, 0xCA, 0xBE, 0xB5, 0x74, 0x8D, 0x83, 0xA1, 0xF9, 0xF0, 0x40, 0x31, 0x75, 0x06, 0xD4},
-        .version = 0x5E,
-        .version_string = "11.4.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0xBD, 0x87, 0xCA, 0x4F, 0x43, 0xB0, 0x99, 0x0E, 0xA0, 0x0B, 0xD8, 0xC3, 0x71, 0xE1, 0x22, 0xD7},
-        .version = 0x64,
-        .version_string = "11.8.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x7B, 0x8A, 0x1A, 0xDE, 0x5D, 0x0B, 0xB4, 0x09, 0xEC, 0x10, 0x5A, 0xBC, 0xA2, 0xC2, 0x66, 0x0C},
-        .version = 0x66,
-        .version_string = "11.12.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0xFF, 0xCE, 0x65, 0x06, 0xE1, 0xBC, 0xF8, 0x60, 0x4C, 0x60, 0x78, 0xC9, 0xC8, 0x8D, 0x11, 0xBF},
-        .version = 0x69,
-        .version_string = "11.14.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x79, 0xE7, 0x2E, 0x3C, 0xDF, 0xC6, 0xBD, 0xDF, 0x84, 0x74, 0x4A, 0xBD, 0x10, 0xDE, 0x89, 0xAE},
-        .version = 0x6C,
-        .version_string = "11.16.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0x7B, 0xF1, 0x39, 0xFE, 0x16, 0x35, 0x55, 0xE3, 0x99, 0x76, 0x41, 0x1D, 0xDD, 0x7B, 0x41, 0x19},
-        .version = 0x03,
-        .version_string = "8.1.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0x31, 0xCC, 0x46, 0xCD, 0x61, 0x7A, 0xE7, 0x13, 0x7F, 0xE5, 0xFC, 0x20, 0x46, 0x91, 0x6A, 0xBB},
-        .version = 0x04,
-        .version_string = "9.0.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0x1C, 0x69, 0x5D, 0xE3, 0x35, 0x51, 0x5F, 0x7F, 0x13, 0x05, 0xCC, 0xFF, 0x59, 0x10, 0x1B, 0xAB},
-        .version = 0x0B,
-        .version_string = "9.3.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0x40, 0x35, 0x6C, 0x9A, 0x24, 0x36, 0x93, 0x7B, 0x76, 0xFE, 0x5D, 0xB1, 0x4D, 0x05, 0x06, 0x52},
-        .version = 0x0F,
-        .version_string = "9.5.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0x89, 0xDC, 0x61, 0x95, 0x20, 0x30, 0x76, 0x93, 0xF5, 0x7A, 0x92, 0xA5, 0x87, 0x60, 0x14, 0x1C},
-        .version = 0x18,
-        .version_string = "9.6.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0xC3, 0xBF, 0x8E, 0xA3, 0xBA, 0x32, 0x85, 0x69, 0xB9, 0xB4, 0x2B, 0xB2, 0x38, 0x2B, 0xA7, 0xF3},
-        .version = 0x1A,
-        .version_string = "10.0.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0x07, 0xFE, 0x9A, 0x62, 0x3F, 0xDE, 0x54, 0xC1, 0x9B, 0x06, 0x91, 0xD8, 0x4F, 0x44, 0x9C, 0x21},
-        .version = 0x1B,
-        .version_string = "10.2.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0x1A, 0x56, 0x5C, 0xFF, 0xC9, 0xCC, 0x62, 0xBB, 0x2B, 0xC2, 0x23, 0xB6, 0x4F, 0x48, 0xD1, 0xCC},
-        .version = 0x1F,
-        .version_string = "10.4.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0x52, 0x30, 0x0F, 0x55, 0xA2, 0x64, 0x4E, 0xFF, 0x96, 0x90, 0xF0, 0xE5, 0x6E, 0xC8, 0x2E, 0xB3},
-        .version = 0x21,
-        .version_string = "11.0.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0x9F, 0xEF, 0x66, 0x42, 0x76, 0x84, 0x39, 0x88, 0xC3, 0x31, 0x55, 0xEC, 0x75, 0xF7, 0x4B, 0x7D},
-        .version = 0x26,
-        .version_string = "11.1.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0xF9, 0x17, 0xEE, 0xDA, 0x83, 0xF6, 0x76, 0x4E, 0x04, 0x38, 0x45, 0x84, 0x36, 0xB3, 0x44, 0x6C},
-        .version = 0x28,
-        .version_string = "11.2.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0x3B, 0xEF, 0xE0, 0xF8, 0x81, 0x03, 0x64, 0xE4, 0x40, 0x21, 0xE4, 0xEF, 0x4A, 0x7B, 0x49, 0xE8},
-        .version = 0x2D,
-        .version_string = "11.3.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0xF8, 0xE6, 0x8C, 0x98, 0x42, 0xBB, 0xFB, 0x87, 0xF0, 0xD9, 0xAB, 0x93, 0x15, 0xB3, 0x2C, 0x84},
-        .version = 0x2F,
-        .version_string = "11.4.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0xC7, 0x09, 0x7B, 0x62, 0xB0, 0xFF, 0x5F, 0xCF, 0x75, 0xDC, 0xEF, 0x98, 0x50, 0xB4, 0xF0, 0x27},
-        .version = 0x35,
-        .version_string = "11.8.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0x10, 0xAB, 0x52, 0x98, 0xA6, 0xF3, 0x9B, 0x90, 0xB7, 0x56, 0x04, 0xAA, 0xCF, 0x51, 0x58, 0xD2},
-        .version = 0x37,
-        .version_string = "11.12.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0x5D, 0x28, 0x4E, 0x60, 0x74, 0xA6, 0x50, 0x9F, 0x94, 0xC6, 0x9C, 0x63, 0x7C, 0x0E, 0xA9, 0xC9},
-        .version = 0x3A,
-        .version_string = "11.14.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0xB8, 0xD2, 0x84, 0x09, 0x9E, 0x85, 0x71, 0x0E, 0x8B, 0xF8, 0xF0, 0x2F, 0x5A, 0x80, 0x89, 0xB1},
-        .version = 0x3D,
-        .version_string = "11.16.0",
-        .console = console_n3ds
-    }, {.version = 0xFF}
-};
-
-struct firm_signature twl_firm_signatures[] = {
-    {
-        .sig = {0x63, 0x71, 0x98, 0x83, 0x5C, 0x19, 0xE0, 0xA5, 0x9E, 0xD2, 0x7B, 0x54, 0xF7, 0x99, 0x0D, 0xF3},
-        .version = 0x16,
-        .version_string = "6.2.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0xDD, 0x48, 0x0A, 0x87, 0xEB, 0x3A, 0x7C, 0x72, 0x87, 0x63, 0x89, 0x13, 0x00, 0x71, 0x97, 0x7F},
-        .version = 0x18,
-        .version_string = "11.8.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0xAA, 0x4C, 0xD8, 0x63, 0x81, 0xC4, 0x53, 0x72, 0xDB, 0x9B, 0x98, 0xEC, 0xE3, 0x9D, 0x9B, 0x0F},
-        .version = 0x00,
-        .version_string = "9.0.0",
-        .console = console_n3ds
-    }, {
-        .sig = {0xD2, 0xF3, 0x8C, 0xB4, 0x53, 0xCF, 0xC5, 0x7E, 0x09, 0x8B, 0xAC, 0x67, 0x32, 0x98, 0x75, 0x32},
-        .version = 0x04,
-        .version_string = "11.8.0",
-        .console = console_n3ds
-    }, {.version = 0xFF}
-};
-
-struct firm_signature agb_firm_signatures[] = {
-    {
-        .sig = {0x65, 0xB7, 0x55, 0x78, 0x97, 0xE6, 0x5C, 0xD6, 0x11, 0x74, 0x95, 0xDD, 0x61, 0xE8, 0x08, 0x40},
-        .version = 0x0B,
-        .version_string = "6.0.0",
-        .console = console_o3ds
-    }, {
-        .sig = {0xAF, 0x81, 0xA1, 0xAB, 0xBA, 0xAC, 0xAC, 0xA7, 0x30, 0xE8, 0xD8, 0x74, 0x7C, 0x47, 0x1C, 0x5D},
-        .version = 0x00,
-        .version_string = "9.0.0",
-        .console = console_n3ds
-    }, {.version = 0xFF}
-};
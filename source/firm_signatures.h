@@ -20,6 +20,10 @@ struct firm_signature {
     enum consoles console;
 };
 
+// These tables are generated from firm_signatures.yaml, sorted by sig.
 extern struct firm_signature firm_signatures[];
+extern const unsigned int firm_signatures_count;
 extern struct firm_signature twl_firm_signatures[];
+extern const unsigned int twl_firm_signatures_count;
 extern struct firm_signature agb_firm_signatures[];
+extern const unsigned int agb_firm_signatures_count;
@@ -0,0 +1,95 @@
+#!/usr/bin/python3
+from sys import argv, stderr, exit
+from binascii import unhexlify
+from yaml import load
+
+# If LibYAML is available, use that, as recommended by the PyYAML wiki.
+try:
+    from yaml import CLoader as Loader
+except ImportError:
+    from yaml import Loader
+
+# Globals
+sig_size = 0x10
+version_string_size = 8
+tables = {
+    "NATIVE_FIRM": "firm_signatures",
+    "TWL_FIRM": "twl_firm_signatures",
+    "AGB_FIRM": "agb_firm_signatures"
+}
+consoles = ["o3ds", "n3ds"]
+
+# Shitty function to kill itself
+def die(string):
+    print(string, file=stderr)
+    exit(1)
+
+if len(argv) < 3:
+    die("Usage: %s <firm_signatures.yaml> <firm_signatures.c>" % argv[0])
+
+try:
+    info = load(open(argv[1]), Loader=Loader)
+except Exception as e:
+    print(e)
+    die("Failed to load the YAML file: %s" % argv[1])
+
+if not isinstance(info, dict):
+    die("Incompatible type for the signature list")
+for firm_type in info:
+    if not firm_type in tables:
+        die("Unknown FIRM type: %s" % firm_type)
+
+# Only write the file once everything checks out, so make doesn't pick up a broken one.
+out = []
+out.append("// Generated by firm_signatures.py from firm_signatures.yaml. Don't edit.\n\n")
+out.append('#include "firm_signatures.h"\n')
+
+for firm_type in tables:
+    signatures = []
+
+    for console in info.get(firm_type, {}):
+        if not console in consoles:
+            die("Unknown console: %s" % console)
+        if not isinstance(info[firm_type][console], dict):
+            die("Incompatible type for console: %s-%s" % (firm_type, console))
+
+        for version in info[firm_type][console]:
+            name = "%s-%s-%x" % (firm_type, console, version)
+            entry = info[firm_type][console][version]
+
+            if not isinstance(version, int) or version >= 0xFF:
+                die("Invalid version: %s" % name)
+            if not isinstance(entry, dict) or not "sig" in entry or not "version" in entry:
+                die("Missing sig or version in: %s" % name)
+
+            try:
+                sig = unhexlify(str(entry["sig"]))
+            except Exception:
+                die("Invalid sig in: %s" % name)
+            if len(sig) != sig_size:
+                die("Sig must be %d bytes long in: %s" % (sig_size, name))
+
+            version_string = str(entry["version"])
+            if len(version_string) >= version_string_size:
+                die("Version string too long in: %s" % name)
+
+            signatures.append((sig, version, version_string, console, name))
+
+    # get_firm_info() does a binary search over the sigs, so they have to be sorted and unique.
+    signatures.sort()
+    for x in range(1, len(signatures)):
+        if signatures[x][0] == signatures[x - 1][0]:
+            die("Duplicate sig: %s and %s" % (signatures[x - 1][4], signatures[x][4]))
+
+    out.append("\nstruct firm_signature %s[] = {\n" % tables[firm_type])
+    for sig, version, version_string, console, name in signatures:
+        out.append("    {\n")
+        out.append("        .sig = {%s},\n" % ", ".join("0x%02X" % x for x in sig))
+        out.append("        .version = 0x%02X,\n" % version)
+        out.append('        .version_string = "%s",\n' % version_string)
+        out.append("        .console = console_%s\n" % console)
+        out.append("    },\n")
+    out.append("};\n")
+    out.append("const unsigned int %s_count = %d;\n" % (tables[firm_type], len(signatures)))
+
+open(argv[2], "w").write("".join(out))
@@ -0,0 +1,74 @@
+#include "keyslot.h"
+
+#include <stdint.h>
+#include "memfuncs.h"
+#include "trace.h"
+#include "external/crypto.h"
+
+// Keeps track of what we've put in every keyslot, so we don't write the same key twice.
+// Every key is written big endian and in normal order, which is all we ever use.
+
+struct keyslot {
+    uint8_t key[3][AES_BLOCK_SIZE];  // Indexed by AES_KEYNORMAL, AES_KEYX and AES_KEYY.
+    uint8_t valid[3];
+    uint8_t scrambled;  // The normal key in use was made from the last keyY we wrote.
+};
+
+struct keyslot_stats keyslot_stats;
+
+static struct keyslot keyslots[AES_KEYSLOTS];
+static int selected_slot = -1;
+
+void keyslot_set(const uint8_t slot, const void *key, const uint32_t key_type)
+{
+    if (slot >= AES_KEYSLOTS || key_type > AES_KEYY) return;
+    struct keyslot *state = &keyslots[slot];
+
+    int same = state->valid[key_type] && memcmp(state->key[key_type], key, AES_BLOCK_SIZE) == 0;
+
+    // Writing the keyY makes the hardware generate a new normal key from the keyX,
+    //   so it only changes nothing if that's the normal key being used already.
+    // Writing a keyX by itself doesn't do anything until the next keyY.
+    if ((key_type == AES_KEYNORMAL && same && !state->scrambled) ||
+            (key_type == AES_KEYX && same) ||
+            (key_type == AES_KEYY && same && state->scrambled)) {
+        keyslot_stats.key_writes_skipped++;
+        return;
+    }
+
+    aes_setkey(slot, key, key_type, AES_INPUT_BE | AES_INPUT_NORMAL);
+    keyslot_stats.key_writes++;
+
+    memcpy(state->key[key_type], key, AES_BLOCK_SIZE);
+    state->valid[key_type] = 1;
+    if (key_type == AES_KEYY) {
+        // Even if the keyX was set by someone else, it's the one in use until we change it.
+        state->scrambled = 1;
+        state->valid[AES_KEYNORMAL] = 0;
+    } else {
+        state->scrambled = 0;
+    }
+
+    // The engine has to load the key again before it notices.
+    if (selected_slot == slot) selected_slot = -1;
+}
+
+void keyslot_use(const uint8_t slot)
+{
+    if (selected_slot == slot) {
+        keyslot_stats.slot_switches_skipped++;
+        return;
+    }
+
+    aes_use_keyslot(slot);
+    keyslot_stats.slot_switches++;
+    selected_slot = slot;
+}
+
+void keyslot_trace()
+{
+    trace_count("key writes", keyslot_stats.key_writes);
+    trace_count("key skips", keyslot_stats.key_writes_skipped);
+    trace_count("slot switches", keyslot_stats.slot_switches);
+    trace_count("slot skips", keyslot_stats.slot_switches_skipped);
+}
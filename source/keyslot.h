@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+#define AES_KEYSLOTS 0x40
+
+// Counted since boot, to see how much the bookkeeping saves us.
+struct keyslot_stats {
+    uint32_t key_writes;
+    uint32_t key_writes_skipped;
+    uint32_t slot_switches;
+    uint32_t slot_switches_skipped;
+};
+
+extern struct keyslot_stats keyslot_stats;
+
+void keyslot_set(const uint8_t slot, const void *key, const uint32_t key_type);
+void keyslot_use(const uint8_t slot);
+void keyslot_trace();
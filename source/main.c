@@ -11,6 +11,8 @@
 #include "fcram.h"
 #include "paths.h"
 #include "headers.h"
+#include "trace.h"
+#include "bitset.h"
 #include "fatfs/sdmmc/sdmmc.h"
 #include "external/i2c.h"
 
@@ -18,48 +20,55 @@
 
 #define MAX_EMUNANDS 9
 
-void menu_select_patches()
+static const char *cake_description(unsigned int index)
 {
-    #if MAX_CAKES > MAX_SELECTED_OPTIONS
-    #error "This function needs MAX_CAKES to be <= MAX_SELECTED_OPTIONS"
-    #endif
+    return cake_list[index].description;
+}
 
+void menu_select_patches()
+{
     if (cake_count <= 0) {
         draw_message("No cakes loaded", "No cakes have been loaded.\nPlease copy them to: " PATH_PATCHES);
         return;
     }
 
-    char *options[cake_count];
-    for (unsigned int i = 0; i < cake_count; i++) {
-        options[i] = cake_list[i].description;
-    }
+    uint32_t previous[BITSET_SIZE(MAX_CAKES)];
+    memcpy(previous, cake_selected, sizeof(previous));
+
+    draw_selection_menu("Select your cakes", cake_count, cake_description, cake_selected);
 
-    int *result = draw_selection_menu("Select your cakes", cake_count, options, cake_selected);
+    patches_modified |= memcmp(previous, cake_selected, sizeof(previous));
+}
 
-    patches_modified |= memcmp(cake_selected, result, sizeof(cake_selected));
+static const char *toggle_options[] = {"Enable autoboot (Press L to enter the menu)",
+                                       "Force saving patched firmware",
+                                       "Silence debug output"};
 
-    // The result location will be reused for other selection menus, so we memcpy it.
-    memcpy(cake_selected, result, cake_count * sizeof(int));
+static const char *toggle_option(unsigned int index)
+{
+    return toggle_options[index];
 }
 
 void menu_toggle()
 {
-    char *options[] = {"Enable autoboot (Press L to enter the menu)",
-                       "Force saving patched firmware",
-                       "Silence debug output"};
     int preselected[] = {config->autoboot_enabled,
                          save_firm,
                          config->silent_boot};
 
-    int *result = draw_selection_menu("Toggleable options", sizeof(options) / sizeof(char *),
-                                      options, preselected);
+    uint32_t selected[BITSET_SIZE(sizeof(preselected) / sizeof(*preselected))] = {0};
+    for (unsigned int i = 0; i < sizeof(preselected) / sizeof(*preselected); i++) {
+        if (preselected[i]) BITSET_SET(selected, i);
+    }
+
+    draw_selection_menu("Toggleable options", sizeof(toggle_options) / sizeof(*toggle_options),
+                        toggle_option, selected);
 
     // Apply the options
-    config->autoboot_enabled = result[0];
-    save_firm = result[1];
-    config->silent_boot = result[2];  // This doesn't change patches.
-    patches_modified |= preselected[0] ? 0 : result[0];
-    patches_modified |= preselected[1] ? 0 : result[1];
+    config->autoboot_enabled = BITSET_GET(selected, 0);
+    save_firm = BITSET_GET(selected, 1);
+    config->silent_boot = BITSET_GET(selected, 2);  // This doesn't change patches.
+    patches_modified |= preselected[0] ? 0 : BITSET_GET(selected, 0);
+    patches_modified |= preselected[1] ? 0 : BITSET_GET(selected, 1);
 }
 
 void menu_emunand()
@@ -112,6 +121,7 @@ void menu_emunand()
 
     config->emunand_location = result * gap;
     patches_modified = 1;
+    patches_reapply = 1;  // The emuNAND offsets are baked into the patches.
 }
 
 void menu_more()
@@ -177,10 +187,13 @@ void menu_main()
         int result = draw_menu("CakesFW " CAKES_VERSION, 0, sizeof(options) / sizeof(char *), options);
 
         switch (result) {
-            case 0:
+            case 0: {
                 save_config();
+                unsigned int span = trace_begin("boot_cfw");
                 boot_cfw();
+                trace_end(span);
                 break;
+            }
             case 1:
                 menu_select_patches();
                 break;
@@ -199,6 +212,9 @@ void menu_main()
 
 void main()
 {
+    trace_init();
+    trace_begin("main");
+
     clear_screens();
 
     if(mount_sd() != 0) {
@@ -242,13 +258,17 @@ void main()
     }
 
     // This function already correctly draws error messages
+    unsigned int span = trace_begin("load_firms");
     if (load_firms() != 0) return;
+    trace_end(span);
 
     print("Loading cakes");
+    span = trace_begin("load_cakes_info");
     if (load_cakes_info(PATH_PATCHES) != 0) {
         draw_loading("Failed to read some cakes", "Make sure your cakes are up to date\n  and your SD card can be read correctly");
         return;
     }
+    trace_end(span);
 
     load_config_cakes();
 
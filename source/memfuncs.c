@@ -3,6 +3,9 @@
 #include <stdint.h>
 #include <stddef.h>
 
+// Keep GCC from turning the loops in here into calls to themselves.
+#pragma GCC optimize ("no-tree-loop-distribute-patterns")
+
 int strlen(const char *string)
 {
     char *string_end = (char *)string;
@@ -10,27 +13,121 @@ int strlen(const char *string)
     return string_end - string;
 }
 
+// Moves 32 bytes at a time, both pointers have to be word aligned.
+// The plain C versions are for the host tests in standalone_patcher.
+static inline void copy_bursts(uint32_t **dest, const uint32_t **src, size_t bursts)
+{
+#ifdef __arm__
+    __asm__ volatile (
+        "1:\n\t"
+        "ldmia %[src]!, {r3-r10}\n\t"
+        "stmia %[dest]!, {r3-r10}\n\t"
+        "subs %[bursts], %[bursts], #1\n\t"
+        "bne 1b\n\t"
+        : [dest] "+r" (*dest), [src] "+r" (*src), [bursts] "+r" (bursts)
+        :
+        : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "cc", "memory"
+    );
+#else
+    for (size_t x = 0; x < bursts * 8; x++) {
+        *(*dest)++ = *(*src)++;
+    }
+#endif
+}
+
+// Same as above, but going down from the end of both buffers.
+static inline void copy_bursts_back(uint32_t **dest, const uint32_t **src, size_t bursts)
+{
+#ifdef __arm__
+    __asm__ volatile (
+        "1:\n\t"
+        "ldmdb %[src]!, {r3-r10}\n\t"
+        "stmdb %[dest]!, {r3-r10}\n\t"
+        "subs %[bursts], %[bursts], #1\n\t"
+        "bne 1b\n\t"
+        : [dest] "+r" (*dest), [src] "+r" (*src), [bursts] "+r" (bursts)
+        :
+        : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "cc", "memory"
+    );
+#else
+    for (size_t x = 0; x < bursts * 8; x++) {
+        *--(*dest) = *--(*src);
+    }
+#endif
+}
+
+static inline void set_bursts(uint32_t **dest, const uint32_t filler, size_t bursts)
+{
+#ifdef __arm__
+    __asm__ volatile (
+        "mov r3, %[filler]\n\t"
+        "mov r4, %[filler]\n\t"
+        "mov r5, %[filler]\n\t"
+        "mov r6, %[filler]\n\t"
+        "mov r7, %[filler]\n\t"
+        "mov r8, %[filler]\n\t"
+        "mov r9, %[filler]\n\t"
+        "mov r10, %[filler]\n\t"
+        "1:\n\t"
+        "stmia %[dest]!, {r3-r10}\n\t"
+        "subs %[bursts], %[bursts], #1\n\t"
+        "bne 1b\n\t"
+        : [dest] "+r" (*dest), [bursts] "+r" (bursts)
+        : [filler] "r" (filler)
+        : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "cc", "memory"
+    );
+#else
+    for (size_t x = 0; x < bursts * 8; x++) {
+        *(*dest)++ = filler;
+    }
+#endif
+}
+
 void memcpy(void *dest, const void *src, size_t size)
 {
-    char *destc = (char *)dest;
-    const char *srcc = (const char *)src;
+    uint8_t *dest8 = (uint8_t *)dest;
+    const uint8_t *src8 = (const uint8_t *)src;
 
-    // If we can align both dest and src together...
-    if ((uintptr_t)srcc % sizeof(size_t) == (uintptr_t)destc % sizeof(size_t)) {
-        // Align them and copy faster
-        while ((uintptr_t)srcc % sizeof(size_t) && size--) {
-            *destc++ = *srcc++;
+    // Not worth aligning anything for tiny copies.
+    if (size >= 8) {
+        while ((uintptr_t)dest8 % 4) {
+            *dest8++ = *src8++;
+            size--;
         }
 
-        for (; size >= sizeof(size_t); size -= sizeof(size_t),
-                destc += sizeof(size_t), srcc += sizeof(size_t)) {
-            *(size_t *)destc = *(size_t *)srcc;
+        uint32_t *dest32 = (uint32_t *)dest8;
+        unsigned int shift = ((uintptr_t)src8 % 4) * 8;
+
+        if (!shift) {
+            const uint32_t *src32 = (const uint32_t *)src8;
+
+            if (size >= 32) copy_bursts(&dest32, &src32, size / 32);
+            for (size %= 32; size >= 4; size -= 4) {
+                *dest32++ = *src32++;
+            }
+
+            src8 = (const uint8_t *)src32;
+        } else {
+            // The source isn't aligned like dest, so read whole words
+            //   and shift the bytes we need out of every two of them.
+            const uint32_t *src32 = (const uint32_t *)((uintptr_t)src8 & ~3);
+            uint32_t current = *src32++;
+
+            for (; size >= 4; size -= 4) {
+                uint32_t next = *src32++;
+                *dest32++ = (current >> shift) | (next << (32 - shift));
+                current = next;
+            }
+
+            src8 = (const uint8_t *)(src32 - 1) + shift / 8;
         }
+
+        dest8 = (uint8_t *)dest32;
     }
 
     // Finish by copying the leftovers
     while (size--) {
-        *destc++ = *srcc++;
+        *dest8++ = *src8++;
     }
 }
 
@@ -42,54 +139,98 @@ void memmove(void *dest, const void *src, size_t size)
     }
 
     // Moving forward is just a reverse memcpy
-    char *destc = (char *)dest;
-    const char *srcc = (const char *)src;
+    uint8_t *dest8 = (uint8_t *)dest + size;
+    const uint8_t *src8 = (const uint8_t *)src + size;
 
-    // If we can align both dest and src together...
-    if ((uintptr_t)srcc % sizeof(size_t) == (uintptr_t)destc % sizeof(size_t)) {
-        // Align them and copy faster
-        while ((uintptr_t)(destc + size) % sizeof(size_t) && size--) {
-            destc[size] = srcc[size];
+    if (size >= 8) {
+        while ((uintptr_t)dest8 % 4) {
+            *--dest8 = *--src8;
+            size--;
         }
 
-        while (size >= sizeof(size_t)) {
-            size -= sizeof(size_t);
-            *(size_t *)(destc + size) = *(size_t *)(srcc + size);
+        uint32_t *dest32 = (uint32_t *)dest8;
+        unsigned int shift = ((uintptr_t)src8 % 4) * 8;
+
+        if (!shift) {
+            const uint32_t *src32 = (const uint32_t *)src8;
+
+            if (size >= 32) copy_bursts_back(&dest32, &src32, size / 32);
+            for (size %= 32; size >= 4; size -= 4) {
+                *--dest32 = *--src32;
+            }
+
+            src8 = (const uint8_t *)src32;
+        } else {
+            const uint32_t *src32 = (const uint32_t *)((uintptr_t)src8 & ~3);
+            uint32_t current = *src32;
+
+            for (; size >= 4; size -= 4) {
+                uint32_t prev = *--src32;
+                *--dest32 = (prev >> shift) | (current << (32 - shift));
+                current = prev;
+            }
+
+            src8 = (const uint8_t *)src32 + shift / 8;
         }
+
+        dest8 = (uint8_t *)dest32;
     }
 
     // Finish by copying the leftovers
     while (size--) {
-        destc[size] = srcc[size];
+        *--dest8 = *--src8;
     }
 }
 
 __attribute__((used))
 void memset(void *dest, const int filler, size_t size)
 {
-    char *destc = (char *)dest;
+    uint8_t *dest8 = (uint8_t *)dest;
 
-    // Align dest to 4 bytes
-    while ((uintptr_t)destc % sizeof(size_t) && size--) {
-        *destc++ = filler;
-    }
+    if (size >= 8) {
+        // Align dest to 4 bytes
+        while ((uintptr_t)dest8 % 4) {
+            *dest8++ = filler;
+            size--;
+        }
+
+        uint32_t *dest32 = (uint32_t *)dest8;
+        uint32_t filler32 = (uint8_t)filler * 0x01010101;
 
-    // Set 32 bytes at a time
-    for (; size >= sizeof(size_t); size -= sizeof(size_t), destc += sizeof(size_t)) {
-        *(size_t *)destc = filler;
+        // Set 32 bytes at a time
+        if (size >= 32) set_bursts(&dest32, filler32, size / 32);
+        for (size %= 32; size >= 4; size -= 4) {
+            *dest32++ = filler32;
+        }
+
+        dest8 = (uint8_t *)dest32;
     }
 
     // Finish
     while (size--) {
-        *destc++ = filler;
+        *dest8++ = filler;
     }
 }
 
 int memcmp(const void *buf1, const void *buf2, const size_t size)
 {
-    const char *buf1c = (const char *)buf1;
-    const char *buf2c = (const char *)buf2;
-    for (size_t i = 0; i < size; i++) {
+    const uint8_t *buf1c = (const uint8_t *)buf1;
+    const uint8_t *buf2c = (const uint8_t *)buf2;
+    size_t i = 0;
+
+    // Skip over equal words, the byte loop finds out which byte differs.
+    // Bytes are compared unsigned, the signature binary search depends on it.
+    if ((uintptr_t)buf1c % 4 == (uintptr_t)buf2c % 4) {
+        for (; i < size && (uintptr_t)(buf1c + i) % 4; i++) {
+            if (buf1c[i] != buf2c[i]) return buf1c[i] - buf2c[i];
+        }
+
+        for (; size - i >= 4; i += 4) {
+            if (*(const uint32_t *)(buf1c + i) != *(const uint32_t *)(buf2c + i)) break;
+        }
+    }
+
+    for (; i < size; i++) {
         int cmp = buf1c[i] - buf2c[i];
         if (cmp) {
             return cmp;
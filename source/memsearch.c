@@ -0,0 +1,64 @@
+#include "memsearch.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef STANDALONE
+#include "memfuncs.h"
+#else
+#include <string.h>
+#endif
+
+void *memsearch(void *start_pos, const void *search, const uint32_t size, const uint32_t size_search)
+{
+    // Searching backwards, since most of the stuff we'll search with this are near the end.
+    for (void *pos = start_pos + size - size_search; pos >= start_pos; pos--) {
+        if (memcmp(pos, search, size_search) == 0) {
+            return pos;
+        }
+    }
+
+    return NULL;
+}
+
+// Finds the last occurrence of every pattern in a single backwards sweep.
+// Patterns have to be at least 4 bytes long, the ones not found are left NULL.
+void memsearch_multi(void *start_pos, const uint32_t size, struct search_pattern *patterns, const unsigned int count)
+{
+    uint32_t first_bytes[0x100 / 32] = {0};
+    unsigned int left = 0;
+
+    for (unsigned int x = 0; x < count; x++) {
+        patterns[x].found = NULL;
+        if (patterns[x].size < 4 || patterns[x].size > size) continue;
+
+        const uint8_t *pattern = patterns[x].pattern;
+        patterns[x].word = pattern[0] | pattern[1] << 8 | pattern[2] << 16 | (uint32_t)pattern[3] << 24;
+        first_bytes[pattern[0] / 32] |= 1u << (pattern[0] % 32);
+        left++;
+    }
+    if (!left || size < 4) return;
+
+    // Keep the 4 bytes starting at the current position in a word,
+    //   shifting one byte in every step back.
+    uint8_t *bytes = start_pos;
+    uint32_t pos = size - 4;
+    uint32_t window = bytes[pos] | bytes[pos + 1] << 8 | bytes[pos + 2] << 16 | (uint32_t)bytes[pos + 3] << 24;
+
+    for (;;) {
+        if (first_bytes[bytes[pos] / 32] & (1u << (bytes[pos] % 32))) {
+            for (unsigned int x = 0; x < count; x++) {
+                if (patterns[x].found || patterns[x].size < 4 || window != patterns[x].word) continue;
+                if (patterns[x].size > size - pos) continue;
+                if (patterns[x].size > 4 && memcmp(bytes + pos + 4, patterns[x].pattern + 4, patterns[x].size - 4) != 0) continue;
+
+                patterns[x].found = bytes + pos;
+                if (!--left) return;
+            }
+        }
+
+        if (!pos) break;
+        pos--;
+        window = window << 8 | bytes[pos];
+    }
+}
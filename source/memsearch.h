@@ -0,0 +1,16 @@
+#pragma once
+
+// Looking for byte patterns in FIRMs and other buffers, see standalone_patcher/memsearch_bench.c.
+
+#include <stdint.h>
+
+// Something to look for with memsearch_multi().
+struct search_pattern {
+    const void *pattern;
+    uint32_t size;
+    uint32_t word;  // The first 4 bytes, filled in by memsearch_multi().
+    void *found;
+};
+
+void *memsearch(void *start_pos, const void *search, const uint32_t size, const uint32_t size_search);
+void memsearch_multi(void *start_pos, const uint32_t size, struct search_pattern *patterns, const unsigned int count);
@@ -5,10 +5,8 @@
 #include "memfuncs.h"
 #include "draw.h"
 #include "hid.h"
+#include "bitset.h"
 
-int selected_options[MAX_SELECTED_OPTIONS];
-
-// TODO: Clean up the first two functions. They have too much in common.
 // No boundary checks, use this responsibly.
 int draw_menu(const char *title, int back, int count, char *options[])
 {
@@ -58,75 +56,101 @@ int draw_menu(const char *title, int back, int count, char *options[])
     }
 }
 
-int *draw_selection_menu(const char *title, int count, char *options[], const int *preselected)
+// Draw an option of the selection menu on a single line, cutting it off if it doesn't fit.
+static void draw_selection_row(const char *option, const int pos_y, const uint32_t color)
 {
-    // The caller has to make sure it does not exceed MAX_SELECTED_OPTIONS
-    if (count > MAX_SELECTED_OPTIONS) {
-        return NULL;
+    char line[(SCREEN_TOP_WIDTH - MARGIN_HORIZ) / SPACING_HORIZ - 4 + 1];
+
+    unsigned int x;
+    for (x = 0; x < sizeof(line) - 1 && option[x] && option[x] != '\n'; x++) {
+        line[x] = option[x];
     }
+    line[x] = 0;
 
-    memset(selected_options, 0, sizeof(selected_options));
+    draw_string(screen_top_left, line, 4 * SPACING_HORIZ, pos_y, color);
+}
 
-    int current = 0;
-    int pos_x_text = 4 * SPACING_HORIZ;
-    int pos_y_text[count];
-    int current_pos_y = 30;
+// Draw the page of options starting at top. Only the ones that fit on the screen are drawn,
+//  so it doesn't matter how many options there are.
+static void draw_selection_page(const char *title, const unsigned int count, const char *(*option)(unsigned int),
+        const uint32_t *selected, const unsigned int top, const unsigned int current)
+{
+    int pos_y = 30;
 
     clear_screen(screen_top_left);
     draw_string(screen_top_left, title, 0, 0, COLOR_TITLE);
 
-    pos_y_text[0] = current_pos_y;
-    draw_string(screen_top_left, "[ ]", 0, current_pos_y, COLOR_NEUTRAL);
-    current_pos_y = draw_string(screen_top_left, options[0], pos_x_text, current_pos_y, COLOR_SELECTED);
-    int i;
-    for (i = 1; i < count; i++) {
-        current_pos_y += SPACING_VERT;
-        pos_y_text[i] = current_pos_y;
-        draw_string(screen_top_left, "[ ]", 0, current_pos_y, COLOR_NEUTRAL);
-        current_pos_y = draw_string(screen_top_left, options[i], pos_x_text, current_pos_y, COLOR_NEUTRAL);
+    if (top > 0) {
+        draw_string(screen_top_left, "...", 4 * SPACING_HORIZ, pos_y - SPACING_VERT, COLOR_NEUTRAL);
     }
-    draw_string(screen_top_left, "Press START to confirm", 0, current_pos_y + SPACING_VERT * 2, COLOR_SELECTED);
 
-    for (int i = 0; i < count; i++) {
-        if (preselected[i]) {
-            draw_character(screen_top_left, 'x', 0 + SPACING_HORIZ, pos_y_text[i], COLOR_NEUTRAL);
-            selected_options[i] = 1;
+    for (unsigned int i = top; i < count && i < top + SELECTION_MENU_ROWS; i++) {
+        draw_string(screen_top_left, "[ ]", 0, pos_y, COLOR_NEUTRAL);
+        if (BITSET_GET(selected, i)) {
+            draw_character(screen_top_left, 'x', 0 + SPACING_HORIZ, pos_y, COLOR_NEUTRAL);
         }
+        draw_selection_row(option(i), pos_y, i == current ? COLOR_SELECTED : COLOR_NEUTRAL);
+        pos_y += SPACING_VERT;
     }
 
-    while (1) {
-        uint16_t key = wait_key();
+    if (top + SELECTION_MENU_ROWS < count) {
+        draw_string(screen_top_left, "...", 4 * SPACING_HORIZ, pos_y, COLOR_NEUTRAL);
+    }
 
-        if (key == (key_released | key_up)) {
-            draw_string(screen_top_left, options[current], pos_x_text, pos_y_text[current], COLOR_NEUTRAL);
+    if (count > SELECTION_MENU_ROWS) {
+        draw_string(screen_top_left, "Press START to confirm, LEFT/RIGHT for pages", 0,
+                    30 + SPACING_VERT * (SELECTION_MENU_ROWS + 2), COLOR_SELECTED);
+    } else {
+        draw_string(screen_top_left, "Press START to confirm", 0,
+                    30 + SPACING_VERT * (SELECTION_MENU_ROWS + 2), COLOR_SELECTED);
+    }
+}
 
-            if (current <= 0) {
-                current = count - 1;
-            } else {
-                current--;
-            }
+// Changes the selected bits in place.
+void draw_selection_menu(const char *title, const unsigned int count, const char *(*option)(unsigned int), uint32_t *selected)
+{
+    unsigned int current = 0;
+    unsigned int top = 0;
 
-            draw_string(screen_top_left, options[current], pos_x_text, pos_y_text[current], COLOR_SELECTED);
-        } else if (key == (key_released | key_down)) {
-            draw_string(screen_top_left, options[current], pos_x_text, pos_y_text[current], COLOR_NEUTRAL);
+    if (count == 0) return;
 
-            if (current >= count - 1) {
-                current = 0;
-            } else {
-                current++;
-            }
+    draw_selection_page(title, count, option, selected, top, current);
 
-            draw_string(screen_top_left, options[current], pos_x_text, pos_y_text[current], COLOR_SELECTED);
+    while (1) {
+        uint16_t key = wait_key();
+        unsigned int previous = current;
+
+        if (key == (key_released | key_up)) {
+            current = current == 0 ? count - 1 : current - 1;
+        } else if (key == (key_released | key_down)) {
+            current = current >= count - 1 ? 0 : current + 1;
+        } else if (key == (key_released | key_left)) {
+            current = current < SELECTION_MENU_ROWS ? 0 : current - SELECTION_MENU_ROWS;
+        } else if (key == (key_released | key_right)) {
+            current = current + SELECTION_MENU_ROWS >= count ? count - 1 : current + SELECTION_MENU_ROWS;
         } else if (key == (key_released | key_a)) {
-            if (selected_options[current]) {
-                draw_character(screen_top_left, 'x', 0 + SPACING_HORIZ, pos_y_text[current], COLOR_BACKGROUND);
-                selected_options[current] = 0;
+            int pos_y = 30 + (current - top) * SPACING_VERT;
+            BITSET_TOGGLE(selected, current);
+            draw_character(screen_top_left, 'x', 0 + SPACING_HORIZ, pos_y,
+                           BITSET_GET(selected, current) ? COLOR_NEUTRAL : COLOR_BACKGROUND);
+            continue;
+        } else if (key == (key_released | key_start) || key == (key_released | key_b)) {
+            return;
+        } else {
+            continue;
+        }
+
+        // Scroll if the cursor went off the page, otherwise only the two rows that changed need drawing.
+        if (current < top || current >= top + SELECTION_MENU_ROWS) {
+            if (current < top) {
+                top = current;
             } else {
-                draw_character(screen_top_left, 'x', 0 + SPACING_HORIZ, pos_y_text[current], COLOR_NEUTRAL);
-                selected_options[current] = 1;
+                top = current - SELECTION_MENU_ROWS + 1;
             }
-        } else if (key == (key_released | key_start) || key == (key_released | key_b)) {
-            return selected_options;
+            draw_selection_page(title, count, option, selected, top, current);
+        } else if (current != previous) {
+            draw_selection_row(option(previous), 30 + (previous - top) * SPACING_VERT, COLOR_NEUTRAL);
+            draw_selection_row(option(current), 30 + (current - top) * SPACING_VERT, COLOR_SELECTED);
         }
     }
 }
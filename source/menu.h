@@ -1,6 +1,9 @@
 #pragma once
 
-#define MAX_SELECTED_OPTIONS 0x10
+#include <stdint.h>
+
+// How many options the selection menu shows at once.
+#define SELECTION_MENU_ROWS 15
 
 #define COLOR_TITLE 0x0000FF
 #define COLOR_NEUTRAL 0xFFFFFF
@@ -8,6 +11,6 @@
 #define COLOR_BACKGROUND 0x000000
 
 int draw_menu(const char *title, int back, int count, char *options[]);
-int *draw_selection_menu(const char *title, int count, char *options[], const int *preselected);
+void draw_selection_menu(const char *title, const unsigned int count, const char *(*option)(unsigned int), uint32_t *selected);
 int draw_loading(const char *title, const char *text);
 void draw_message(const char *title, const char *text);
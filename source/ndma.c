@@ -0,0 +1,80 @@
+#include "ndma.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include "memfuncs.h"
+#include "cache.h"
+
+void ndma_start(const unsigned int channel, const volatile void *src, volatile void *dest,
+                const uint32_t words, const uint32_t block_words, const uint32_t flags)
+{
+    *REG_NDMA_GCNT |= NDMA_GCNT_ENABLE;
+
+    *REG_NDMA_CNT(channel) = 0;
+    *REG_NDMA_SAD(channel) = (uintptr_t)src;
+    *REG_NDMA_DAD(channel) = (uintptr_t)dest;
+    *REG_NDMA_TCNT(channel) = words;
+    *REG_NDMA_WCNT(channel) = block_words;  // Words to transfer every time the startup condition triggers.
+    *REG_NDMA_BCNT(channel) = 0;
+    *REG_NDMA_CNT(channel) = flags | NDMA_ENABLE;
+}
+
+int ndma_busy(const unsigned int channel)
+{
+    return (*REG_NDMA_CNT(channel) & NDMA_ENABLE) != 0;
+}
+
+void ndma_wait(const unsigned int channel)
+{
+    while (ndma_busy(channel));
+}
+
+// Only FCRAM, the ARM9 RAM, VRAM and AXI WRAM are on the bus the NDMA engine uses.
+// The TCMs especially aren't.
+static int ndma_can_access(const void *start, const size_t size)
+{
+    uintptr_t addr = (uintptr_t)start;
+    uintptr_t end = addr + size;
+
+    return end >= addr && ((addr >= 0x08000000 && end <= 0x08200000) ||
+                           (addr >= 0x18000000 && end <= 0x30000000));
+}
+
+// Starts copying in the background if it's big enough, otherwise just copies it.
+// Neither of the buffers should be touched until ndma_copy_wait(), and they can't overlap.
+void ndma_copy_start(void *dest, const void *src, const size_t size)
+{
+    // There's only one channel for this.
+    ndma_copy_wait();
+
+    if (size < NDMA_COPY_MIN_SIZE || ((uintptr_t)dest & 3) != ((uintptr_t)src & 3) ||
+            !ndma_can_access(dest, size) || !ndma_can_access(src, size)) {
+        memcpy(dest, src, size);
+        return;
+    }
+
+    // The engine only moves whole words, the CPU does the rest.
+    size_t head = -(uintptr_t)dest & 3;
+    size_t words = (size - head) / 4;
+    size_t tail = (size - head) & 3;
+    memcpy(dest, src, head);
+    memcpy(dest + size - tail, src + size - tail, tail);
+
+    // NDMA doesn't go through the data cache.
+    cache_clean_range(src, size);
+    cache_flush_range(dest, size);
+
+    ndma_start(NDMA_CHANNEL_COPY, src + head, dest + head, words, words,
+               NDMA_IMMEDIATE | NDMA_SRC_UPDATE_INC | NDMA_DST_UPDATE_INC | NDMA_BURST_WORDS(16));
+}
+
+void ndma_copy_wait()
+{
+    ndma_wait(NDMA_CHANNEL_COPY);
+}
+
+void ndma_copy(void *dest, const void *src, const size_t size)
+{
+    ndma_copy_start(dest, src, size);
+    ndma_copy_wait();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The ARM9's NDMA engine. Every channel has its own set of registers.
+// The host models in standalone_patcher can move them elsewhere.
+#ifndef NDMA_BASE
+#define NDMA_BASE ((uintptr_t)0x10002000)
+#endif
+#define REG_NDMA_GCNT ((volatile uint32_t *)NDMA_BASE)
+#define REG_NDMA_SAD(n) ((volatile uint32_t *)(NDMA_BASE + 0x04 + (n) * 0x1C))
+#define REG_NDMA_DAD(n) ((volatile uint32_t *)(NDMA_BASE + 0x08 + (n) * 0x1C))
+#define REG_NDMA_TCNT(n) ((volatile uint32_t *)(NDMA_BASE + 0x0C + (n) * 0x1C))
+#define REG_NDMA_WCNT(n) ((volatile uint32_t *)(NDMA_BASE + 0x10 + (n) * 0x1C))
+#define REG_NDMA_BCNT(n) ((volatile uint32_t *)(NDMA_BASE + 0x14 + (n) * 0x1C))
+#define REG_NDMA_FDATA(n) ((volatile uint32_t *)(NDMA_BASE + 0x18 + (n) * 0x1C))
+#define REG_NDMA_CNT(n) ((volatile uint32_t *)(NDMA_BASE + 0x1C + (n) * 0x1C))
+
+#define NDMA_GCNT_ENABLE 0x00000001
+
+#define NDMA_DST_UPDATE_INC (0 << 10)
+#define NDMA_DST_UPDATE_FIXED (2 << 10)
+#define NDMA_SRC_UPDATE_INC (0 << 13)
+#define NDMA_SRC_UPDATE_FIXED (2 << 13)
+#define NDMA_SRC_UPDATE_FILL (3 << 13)
+#define NDMA_BURST_WORDS(n) (__builtin_ctz(n) << 16)  // Has to be a power of two.
+#define NDMA_STARTUP_AES_IN (8 << 24)
+#define NDMA_STARTUP_AES_OUT (9 << 24)
+#define NDMA_IMMEDIATE (1 << 28)
+#define NDMA_ENABLE 0x80000000
+
+// Channels in use. Keep the AES ones together, they always run at the same time.
+#define NDMA_CHANNEL_AES_IN 0
+#define NDMA_CHANNEL_AES_OUT 1
+#define NDMA_CHANNEL_COPY 2
+
+// Anything smaller is copied by the CPU, it's not worth the setup and cache maintenance.
+#define NDMA_COPY_MIN_SIZE 0x1000
+
+void ndma_start(const unsigned int channel, const volatile void *src, volatile void *dest,
+                const uint32_t words, const uint32_t block_words, const uint32_t flags);
+int ndma_busy(const unsigned int channel);
+void ndma_wait(const unsigned int channel);
+
+void ndma_copy_start(void *dest, const void *src, const size_t size);
+void ndma_copy_wait();
+void ndma_copy(void *dest, const void *src, const size_t size);
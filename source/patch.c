@@ -5,6 +5,9 @@
 #include <assert.h>
 #include "headers.h"
 #include "firm.h"
+#include "blz.h"
+#include "delta.h"
+#include "memsearch.h"
 
 #ifndef STANDALONE
 #include "draw.h"
@@ -17,31 +20,51 @@
 #include "fatfs/ff.h"
 #include "fatfs/sdmmc/sdmmc.h"
 #include "external/crypto.h"
+#include "ndma.h"
+#include "trace.h"
 #else
 #include <string.h>
 #include <stdio.h>
 #include "fcram.h"
 #include "firm.h"
+#include "sha_soft.h"
 #define print(string) puts(string)
 #define draw_message(title, description) printf("-- %s:\n%s\n", title, description)
 #endif
 
-#define FORMAT_VERSION 1
-#define MAX_MEMORY_PATCHES 0x10
+#define FORMAT_VERSION 2
+#define MIN_FORMAT_VERSION 1
+#define MAX_DIRTY_RANGES 0x40
+#define MAX_JOURNAL_RANGES 0x10
+#define MAX_PROCESS9_CACHE 0x20
+#define CATALOG_MAGIC 0x54414343  // "CCAT"
+#define CATALOG_VERSION 2
+#define CATALOG_READ_SIZE 0x4000
+#define MAX_FREE_MEMORY 0x20
+#define MAX_SHARED_MEMORY 0x10
+#define MEMORY_ANY 0xFF
+#define SYSMODULE_STAGE_SIZE (FCRAM_SPACING * 2)
+#define SYSMODULE_SCRATCH_SIZE (FCRAM_SPACING * 2)
 
 enum types {
     TYPE_FIRM,
     TYPE_MEMORY,
     TYPE_USERLAND,
-    TYPE_SYSMODULE
+    TYPE_SYSMODULE,
+    TYPE_DELTA
 };
 
 enum patch_options {
     patch_option_keyx = 0b00000001,
     patch_option_emunand = 0b00000010,
-    patch_option_save = 0b00000100
+    patch_option_save = 0b00000100,
+    patch_option_compressed = 0b01000000,
+    patch_option_sorted = 0b10000000
 };
 
+// The options that are applied to the patch itself, rather than describing the cake.
+#define PATCH_OPTIONS_APPLIED (patch_option_keyx | patch_option_emunand | patch_option_save)
+
 struct cake_header {
     uint8_t version;
     uint8_t patch_count;
@@ -54,7 +77,10 @@ struct patch {
     union {
         struct {
             uint16_t firm_type;
-            uint16_t memory_id;
+            union {
+                uint16_t memory_id;
+                uint16_t section;  // For deltas, the FIRM section, or zero for a sysmodule.
+            };
             uint32_t memory_offset;
         } __attribute__((packed));
         char name[8];
@@ -78,19 +104,136 @@ struct patch_version {
     };
     uint32_t offset;
     uint32_t values_offset;
+    uint32_t file_offset;  // Format version 2 and up
 } __attribute__((packed));
 
-struct memory_location {
+// Format version 1 cakes don't have the file offset in their versions.
+#define VERSION_SIZE(format) ((format) >= 2 ? sizeof(struct patch_version) : offsetof(struct patch_version, file_offset))
+#define VERSION_AT(versions, size, x) ((struct patch_version *)((uintptr_t)(versions) + (x) * (size)))
+
+struct memory_id {
+    uint16_t id;
+    uint16_t hooked;
+    uint32_t location;
+};
+
+struct memory_hook {
+    uint16_t id;
+    uint32_t *location;
+};
+
+// Somewhere memory patches can go, for the FIRMs that match.
+struct memory_region {
+    uint8_t firm_type;  // MEMORY_ANY for all of them
+    uint8_t console;  // MEMORY_ANY for both
+    uint16_t version_min;
+    uint16_t version_max;
     uint32_t location;
     uint32_t size;
-    uint32_t used_size;
+    uint32_t alignment;  // Power of two, at least 4
+};
+
+struct memory_range {
+    uint32_t start;
+    uint32_t end;
+    unsigned int region;
+};
+
+// A sysmodule a cake replaces or adds, waiting for rebuild_sysmodules(). The NCCH follows it.
+struct staged_sysmodule {
+    uint32_t size;  // Of the NCCH.
+    uint16_t cake;  // Index of the cake it came from.
+    uint8_t firm_type;
+    uint8_t used;  // Already laid out by the rebuild.
+};
+
+// Where Process9 is in every FIRM version we've seen, saved to the SD card.
+struct process9_cache {
+    uint32_t count;
+    struct {
+        uint8_t firm_type;
+        uint8_t console;
+        uint16_t version;
+        uint32_t offset;
+        uint32_t address;
+        uint32_t size;
+    } entry[MAX_PROCESS9_CACHE];
+};
+
+// The parts of a FIRM that have been patched since the last reset.
+struct dirty_ranges {
+    int valid;  // Whether everything outside of the ranges matches the original FIRM.
+    unsigned int count;  // Bigger than MAX_DIRTY_RANGES if we ran out of space.
+    struct {
+        uint32_t start;
+        uint32_t end;
+    } range[MAX_DIRTY_RANGES];
 };
 
 #ifndef STANDALONE
+// What applying a cake changed, so it can be undone without reapplying all the others.
+struct cake_journal {
+    int applied;
+    int complete;  // Whether all the ranges it patched fit in here.
+    unsigned int range_count;
+    struct {
+        uint16_t firm_type;
+        uint32_t start;
+        uint32_t end;
+    } range[MAX_JOURNAL_RANGES];
+    uint32_t memory_start;  // Its memory patches, as offsets into memory_loc.
+    uint32_t memory_end;
+    int save;  // It needs the patched FIRMs saved, see patch_options().
+};
+
+// What the cake list needs to know about every cake, saved to the SD card so they don't have to be read every boot.
+struct cake_catalog {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format;  // The cake format version the entries were parsed with.
+    uint32_t count;
+    uint32_t size;  // Including this header.
+};
+
+struct catalog_entry {
+    char path[_MAX_LFN + 1];
+    char description[0x100];
+    uint32_t size;  // The size and timestamp tell us if the cake changed since.
+    uint16_t date;
+    uint16_t time;
+    uint8_t firm_types;  // The FIRM types the cake needs loaded.
+    uint8_t patch_firm_types;  // The FIRM types it has patches for.
+    uint8_t inplace_firm_types;  // The FIRM types it has FIRM patches or deltas for, which follow their layout.
+    uint16_t version_count;
+    uint32_t versions[];  // FIRM type << 24 | console << 16 | FIRM version, for all of its patches.
+};
+
+#define CATALOG_ENTRY_SIZE(entry) (sizeof(struct catalog_entry) + (entry)->version_count * sizeof(uint32_t))
+
 struct cake_info *cake_list = (struct cake_info *)FCRAM_CAKE_LIST;
 unsigned int cake_count = 0;
+uint32_t cake_selected[BITSET_SIZE(MAX_CAKES)];
+unsigned int firms_needed = 1 << NATIVE_FIRM;
+int patches_reapply = 0;
+int patches_save_firm = 0;
+
+static struct cake_journal *cake_journal = (struct cake_journal *)FCRAM_CAKE_JOURNAL;
+static_assert(MAX_CAKES * sizeof(struct cake_journal) <= FCRAM_SPACING, "The cake journals don't fit");
+static struct cake_journal *current_journal = NULL;
+static int journal_valid = 0;
 
 static struct cake_header *firm_patch_temp = (struct cake_header *)FCRAM_FIRM_PATCH_TEMP;
+
+static struct cake_catalog *cake_catalog = (struct cake_catalog *)FCRAM_CAKE_CATALOG;
+static struct cake_catalog *cake_catalog_new = (struct cake_catalog *)FCRAM_CAKE_CATALOG_NEW;
+static int cake_catalog_valid = 0;
+static int cake_catalog_dirty = 0;
+static unsigned int catalog_next = 0;
+static struct catalog_entry *catalog_next_entry = NULL;
+
+// The cake list grows up from the start of its space, and the strings it points to grow down from the end.
+static char *cake_strings = (char *)(FCRAM_CAKE_LIST + FCRAM_SPACING);
+static char cake_path[_MAX_LFN + 1];
 #endif
 
 firm_h *firm_loc = (firm_h *)FCRAM_FIRM_LOC;
@@ -100,62 +243,344 @@ firm_h *agb_firm_loc = (firm_h *)FCRAM_AGB_FIRM_LOC;
 uint32_t *memory_loc = (uint32_t *)FCRAM_MEMORY_LOC;
 static void *current_memory_loc;
 
-// Usable memory locations for arm9 memory patches.
-struct memory_location memory_locations[] = {
+static struct dirty_ranges dirty_ranges[AGB_FIRM + 1];
+
+// How far each FIRM can grow in its space, see fcram.h.
+static const size_t firm_capacity[] = {FCRAM_SPACING, FCRAM_SPACING * 2, FCRAM_SPACING};
+
+#ifndef STANDALONE
+static void *sysmodule_stage = (void *)FCRAM_SYSMODULE_STAGE;
+static void *sysmodule_scratch = (void *)FCRAM_SYSMODULE_SCRATCH;
+#else
+static uint8_t sysmodule_stage[SYSMODULE_STAGE_SIZE];
+static uint8_t sysmodule_scratch[SYSMODULE_SCRATCH_SIZE];
+#endif
+static uint32_t sysmodule_stage_size = 0;
+static int sysmodules_rebuilt[AGB_FIRM + 1];  // The sysmodule section isn't laid out like the original anymore.
+
+// Every memory ID and FIRM hook in the cake being applied, see patch_firm().
+// There can't be more of either than there are patches, which a cake can have 0xFF of.
+#define MAX_MEMORY_IDS 0x200  // A hash table, twice as big as it has to be
+#define MAX_MEMORY_HOOKS 0x100
+
+struct patch_tables {
+    struct memory_id memory_ids[MAX_MEMORY_IDS];
+    struct memory_hook hooks[MAX_MEMORY_HOOKS];
+};
+
+#ifndef STANDALONE
+static struct patch_tables *patch_tables = (struct patch_tables *)FCRAM_PATCH_TABLES;
+static_assert(sizeof(struct patch_tables) <= FCRAM_SPACING, "The patch tables don't fit");
+#else
+static struct patch_tables patch_tables_buffer;
+static struct patch_tables *patch_tables = &patch_tables_buffer;
+#endif
+
+// Usable memory regions for arm9 memory patches, per FIRM type and version.
+static const struct memory_region memory_regions[] = {
     {
+        .firm_type = MEMORY_ANY,
+        .console = MEMORY_ANY,
+        .version_min = 0,
+        .version_max = 0xFFFF,
         .location = 0x01FF8000,
-        .size = 0x00003700  // It's probable more of this area is usable, but I'm not exactly sure what parts.
-    }, {.location = 0xFFFFFFFF}
+        .size = 0x00003700,  // It's probable more of this area is usable, but I'm not exactly sure what parts.
+        .alignment = 4
+    }
 };
+#define MEMORY_REGION_COUNT (sizeof(memory_regions) / sizeof(*memory_regions))
+
+// What's left of the regions, sorted by address.
+static struct memory_range free_memory[MAX_FREE_MEMORY];
+static unsigned int free_memory_count = 0;
+
+// Blocks in memory_loc that more than one patch points to, as offsets into it.
+static uint32_t shared_memory[MAX_SHARED_MEMORY];
+static unsigned int shared_memory_count = 0;
+
+static uint32_t memory_used = 0;
+static uint32_t memory_high_water = 0;
+
+static int memory_region_usable(const struct memory_region *region,
+        const enum firm_types firm_type, const struct firm_signature *firm_info)
+{
+    if (region->firm_type != MEMORY_ANY && region->firm_type != firm_type) return 0;
+    if (region->console != MEMORY_ANY && (!firm_info || region->console != firm_info->console)) return 0;
+    if (region->version_min != 0 || region->version_max != 0xFFFF) {
+        if (!firm_info) return 0;
+        if (firm_info->version < region->version_min || firm_info->version > region->version_max) return 0;
+    }
+    return 1;
+}
+
+static unsigned int find_memory_region(const uint32_t location)
+{
+    unsigned int x;
+    for (x = 0; x < MEMORY_REGION_COUNT; x++) {
+        if (location >= memory_regions[x].location &&
+                location < memory_regions[x].location + memory_regions[x].size) {
+            break;
+        }
+    }
+    return x;
+}
+
+// Puts a range back in the free list, merging it with its neighbours.
+// Returns 1 if the list was full and some free memory had to be dropped.
+static int free_memory_range(const uint32_t start, const uint32_t end, const unsigned int region)
+{
+    if (start == end) return 0;
+
+    unsigned int x;
+    for (x = 0; x < free_memory_count && free_memory[x].start < start; x++);
+
+    struct memory_range *prev = x > 0 ? &free_memory[x - 1] : NULL;
+    struct memory_range *next = x < free_memory_count ? &free_memory[x] : NULL;
+    int join_prev = prev && prev->region == region && prev->end == start;
+    int join_next = next && next->region == region && next->start == end;
+
+    if (join_prev && join_next) {
+        prev->end = next->end;
+        memmove(next, next + 1, (free_memory_count - x - 1) * sizeof(*next));
+        free_memory_count--;
+    } else if (join_prev) {
+        prev->end = end;
+    } else if (join_next) {
+        next->start = start;
+    } else if (free_memory_count < MAX_FREE_MEMORY) {
+        memmove(&free_memory[x + 1], &free_memory[x], (free_memory_count - x) * sizeof(*free_memory));
+        free_memory[x].start = start;
+        free_memory[x].end = end;
+        free_memory[x].region = region;
+        free_memory_count++;
+    } else {
+        // No room for it, so keep the bigger one of it and the smallest range in the list.
+        // Whichever is dropped is lost until the next reset, which is better than not booting.
+        unsigned int smallest = 0;
+        for (unsigned int y = 1; y < free_memory_count; y++) {
+            if (free_memory[y].end - free_memory[y].start <
+                    free_memory[smallest].end - free_memory[smallest].start) {
+                smallest = y;
+            }
+        }
+
+        if (free_memory[smallest].end - free_memory[smallest].start < end - start) {
+            memmove(&free_memory[smallest], &free_memory[smallest + 1],
+                    (free_memory_count - smallest - 1) * sizeof(*free_memory));
+            free_memory_count--;
+            free_memory_range(start, end, region);
+        }
+
+        print("Free memory list full");
+        return 1;
+    }
+
+    return 0;
+}
 
 // Allocates memory for usage AFTER booting.
-void *allocate_memory(uint32_t *physical_address, size_t size)
+void *allocate_memory(uint32_t *physical_address, size_t size,
+        const enum firm_types firm_type, const struct firm_signature *firm_info)
 {
+    // Calculate alignment to 4 bytes, so the next header is aligned as well.
+    uint32_t aligned_size = (size + 3) & ~3;
+
     // Check for the remaining space in memory_loc
-    if (current_memory_loc + size > (void *)memory_loc + FCRAM_SPACING) {
+    if (current_memory_loc + sizeof(struct memory_header) + aligned_size > (void *)memory_loc + FCRAM_SPACING) {
         print("Out of memory");
         draw_message("Out of memory", "We ran out of available memory to store memory patches.");
         return NULL;
     }
 
-    struct memory_location *location;
-    for (location = memory_locations; location->location != 0xFFFFFFFF; location++) {
-        if (location->size - location->used_size > size) {
-            // Calculate alignment to 4 bytes
-            int align = 4 - size % 4;
-            if (align == 4) align = 0;
+    // Best fit: the free range that leaves the least behind.
+    struct memory_range *best = NULL;
+    uint32_t best_start = 0;
+    uint32_t best_waste = 0;
+    for (unsigned int x = 0; x < free_memory_count; x++) {
+        struct memory_range *range = &free_memory[x];
+        const struct memory_region *region = &memory_regions[range->region];
+        if (!memory_region_usable(region, firm_type, firm_info)) continue;
+
+        // What's skipped to align the start can't be used by anything else in this region.
+        uint32_t start = (range->start + region->alignment - 1) & ~(region->alignment - 1);
+        uint32_t padding = start - range->start;
+        if (padding >= range->end - range->start || range->end - start < aligned_size) continue;
+
+        uint32_t waste = padding + (range->end - start - aligned_size);
+        if (!best || waste < best_waste) {
+            best = range;
+            best_start = start;
+            best_waste = waste;
+        }
+    }
+
+    // Splitting a range needs one more entry in the list.
+    if (!best || free_memory_count >= MAX_FREE_MEMORY) {
+        print("Out of system memory");
+        draw_message("Out of system memory", "We ran out of usable space to install this memory patch to.");
+        return NULL;
+    }
+
+    struct memory_range range = *best;
+    memmove(best, best + 1, (free_memory_count - (best - free_memory) - 1) * sizeof(*best));
+    free_memory_count--;
+    free_memory_range(range.start, best_start, range.region);
+    free_memory_range(best_start + aligned_size, range.end, range.region);
+
+    // Create the header
+    struct memory_header *header = current_memory_loc;
+    header->location = best_start;
+    header->size = aligned_size;
+
+    // Blocks get compared when sharing them, so don't leave garbage in the padding.
+    memset((void *)(header + 1) + size, 0, aligned_size - size);
+
+    // Let everyone know we have allocated new memory
+    current_memory_loc += sizeof(struct memory_header) + aligned_size;
+    *memory_loc += sizeof(struct memory_header) + aligned_size;
+
+    memory_used += aligned_size;
+    if (memory_used > memory_high_water) memory_high_water = memory_used;
+
+    *physical_address = header->location;
+    return header + 1;
+}
+
+// Gives back the memory of a block in memory_loc to the region it came from.
+static void release_memory(const uint32_t location, const uint32_t size)
+{
+    unsigned int region = find_memory_region(location);
+    if (region < MEMORY_REGION_COUNT) {
+        free_memory_range(location, location + size, region);
+    }
+    memory_used -= size;
+}
+
+// If an earlier memory patch is the exact same as the one just allocated,
+//   drop the new one and point to that one instead.
+static void share_memory(void *memory, uint32_t *physical_address,
+        const enum firm_types firm_type, const struct firm_signature *firm_info)
+{
+    struct memory_header *header = (struct memory_header *)memory - 1;
 
-            // Create the header
-            struct memory_header *header = current_memory_loc;
-            header->location = location->location + location->used_size;
-            header->size = size + align;
+    for (struct memory_header *other = (void *)(memory_loc + 1); other < header;
+            other = (void *)((uintptr_t)(other + 1) + other->size)) {
+        if (other->size != header->size || memcmp(other + 1, memory, header->size) != 0) continue;
 
-            // Let everyone know we have allocated new memory
-            current_memory_loc += sizeof(struct memory_header) + size + align;
-            *memory_loc += sizeof(struct memory_header) + size + align;
-            location->used_size += size + align;
+        unsigned int region = find_memory_region(other->location);
+        if (region >= MEMORY_REGION_COUNT ||
+                !memory_region_usable(&memory_regions[region], firm_type, firm_info)) {
+            continue;
+        }
 
-            *physical_address = header->location;
-            return header + 1;
+        // Unapplying the cake that owns the block has to know it's still in use.
+        uint32_t offset = (uintptr_t)other - (uintptr_t)memory_loc;
+        unsigned int x;
+        for (x = 0; x < shared_memory_count && shared_memory[x] != offset; x++);
+        if (x == shared_memory_count) {
+            if (shared_memory_count >= MAX_SHARED_MEMORY) return;
+            shared_memory[shared_memory_count++] = offset;
         }
+
+        release_memory(header->location, header->size);
+
+        // Patch options may have allocated more after it, those move down to take its place.
+        uint32_t block_size = sizeof(struct memory_header) + header->size;
+        void *next = (void *)header + block_size;
+        memmove(header, next, current_memory_loc - next);
+        current_memory_loc -= block_size;
+        *memory_loc -= block_size;
+
+        *physical_address = other->location;
+        return;
     }
+}
 
-    print("Out of system memory");
-    draw_message("Out of system memory", "We ran out of usable space to install this memory patch to.");
-    return NULL;
+#ifndef STANDALONE
+// How full the memory regions are, for the boot trace.
+static void report_memory()
+{
+    uint32_t free = 0;
+    uint32_t largest = 0;
+    for (unsigned int x = 0; x < free_memory_count; x++) {
+        uint32_t size = free_memory[x].end - free_memory[x].start;
+        free += size;
+        if (size > largest) largest = size;
+    }
+
+    trace_count("memory used", memory_used);
+    trace_count("memory high water", memory_high_water);
+    trace_count("memory free", free);
+    trace_count("memory largest free", largest);
+    trace_count("memory fragments", free_memory_count);
+    trace_count("memory shared", shared_memory_count);
+}
+#endif
+
+// Remember which part of a FIRM we're about to write to, so patch_reset() can undo it.
+void mark_dirty(const enum firm_types firm_type, const firm_h *firm, const void *start, const uint32_t size)
+{
+    struct dirty_ranges *dirty = &dirty_ranges[firm_type];
+    uint32_t range_start = (uintptr_t)start - (uintptr_t)firm;
+    uint32_t range_end = range_start + size;
+
+#ifndef STANDALONE
+    if (current_journal) {
+        if (current_journal->range_count < MAX_JOURNAL_RANGES) {
+            current_journal->range[current_journal->range_count].firm_type = firm_type;
+            current_journal->range[current_journal->range_count].start = range_start;
+            current_journal->range[current_journal->range_count].end = range_end;
+            current_journal->range_count++;
+        } else {
+            current_journal->complete = 0;
+        }
+    }
+#endif
+
+    if (dirty->count > MAX_DIRTY_RANGES) return;
+
+    // Merge it with a range it touches, if there's any.
+    for (unsigned int x = 0; x < dirty->count; x++) {
+        if (range_start <= dirty->range[x].end && range_end >= dirty->range[x].start) {
+            if (range_start < dirty->range[x].start) dirty->range[x].start = range_start;
+            if (range_end > dirty->range[x].end) dirty->range[x].end = range_end;
+            return;
+        }
+    }
+
+    if (dirty->count < MAX_DIRTY_RANGES) {
+        dirty->range[dirty->count].start = range_start;
+        dirty->range[dirty->count].end = range_end;
+    }
+
+    // If it doesn't fit, this will make patch_reset() copy the whole FIRM.
+    dirty->count++;
 }
 
 #ifndef STANDALONE
-void *memsearch(void *start_pos, const void *search, const uint32_t size, const uint32_t size_search)
+void reset_firm(firm_h *firm, const firm_h *firm_orig, const size_t size, struct dirty_ranges *dirty)
 {
-    // Searching backwards, since most of the stuff we'll search with this are near the end.
-    for (void *pos = start_pos + size - size_search; pos >= start_pos; pos--) {
-        if (memcmp(pos, search, size_search) == 0) {
-            return pos;
+    // These run in the background, call ndma_copy_wait() before touching the FIRM.
+    if (!dirty->valid || dirty->count > MAX_DIRTY_RANGES) {
+        ndma_copy_start(firm, firm_orig, size);
+        dirty->valid = 1;
+    } else {
+        // Only restore what has been patched.
+        // Past the end of the original there's only what the sysmodule section grew into, which is cleared.
+        for (unsigned int x = 0; x < dirty->count; x++) {
+            uint32_t start = dirty->range[x].start;
+            uint32_t end = dirty->range[x].end;
+            if (end > size) {
+                uint32_t grown = start > size ? start : size;
+                memset((void *)firm + grown, 0, end - grown);
+                end = size;
+            }
+
+            if (start < end) ndma_copy_start((void *)firm + start, (void *)firm_orig + start, end - start);
         }
     }
 
-    return NULL;
+    dirty->count = 0;
 }
 
 int get_emunand_offsets(const uint32_t location, uint32_t *offset, uint32_t *header)
@@ -189,6 +614,27 @@ int get_emunand_offsets(const uint32_t location, uint32_t *offset, uint32_t *hea
 
 int patch_options(void *address, const uint32_t size, const uint8_t options, const enum firm_types type)
 {
+    // Look for every marker we may need in one go.
+    enum {
+        marker_keyx,
+        marker_nand,
+        marker_ncsd,
+        marker_natf,
+        marker_twlf,
+        marker_agbf
+    };
+    struct search_pattern markers[] = {
+        [marker_keyx] = {.pattern = "slot0x25keyXhere", .size = AES_BLOCK_SIZE},
+        [marker_nand] = {.pattern = "NAND", .size = 4},
+        [marker_ncsd] = {.pattern = "NCSD", .size = 4},
+        [marker_natf] = {.pattern = "NATF", .size = 4},
+        [marker_twlf] = {.pattern = "TWLF", .size = 4},
+        [marker_agbf] = {.pattern = "AGBF", .size = 4}
+    };
+    if (options & (patch_option_keyx | patch_option_emunand | patch_option_save)) {
+        memsearch_multi(address, size, markers, sizeof(markers) / sizeof(*markers));
+    }
+
     if (options & patch_option_keyx) {
         print("Patch option: Adding keyX");
 
@@ -196,7 +642,7 @@ int patch_options(void *address, const uint32_t size, const uint8_t options, con
             0xCE, 0xE7, 0xD8, 0xAB, 0x30, 0xC0, 0x0D, 0xAE, 0x85, 0x0E, 0xF5, 0xE3, 0x82, 0xAC, 0x5A, 0xF3
         };
 
-        void *pos = memsearch(address, "slot0x25keyXhere", size, AES_BLOCK_SIZE);
+        void *pos = markers[marker_keyx].found;
         if (pos) {
             memcpy(pos, key, AES_BLOCK_SIZE);
         } else {
@@ -219,8 +665,8 @@ int patch_options(void *address, const uint32_t size, const uint8_t options, con
             return 1;
         }
 
-        uint32_t *pos_offset = memsearch(address, "NAND", size, 4);
-        uint32_t *pos_header = memsearch(address, "NCSD", size, 4);
+        uint32_t *pos_offset = markers[marker_nand].found;
+        uint32_t *pos_header = markers[marker_ncsd].found;
         if (pos_offset && pos_header) {
             *pos_offset = offset;
             *pos_header = header;
@@ -236,9 +682,9 @@ int patch_options(void *address, const uint32_t size, const uint8_t options, con
     if (options & patch_option_save && type == NATIVE_FIRM) {
         print("Patch option: Save firm");
 
-        uint32_t *pos_native = memsearch(address, "NATF", size, 4);
-        uint32_t *pos_twl = memsearch(address, "TWLF", size, 4);
-        uint32_t *pos_agb = memsearch(address, "AGBF", size, 4);
+        uint32_t *pos_native = markers[marker_natf].found;
+        uint32_t *pos_twl = markers[marker_twlf].found;
+        uint32_t *pos_agb = markers[marker_agbf].found;
         if (!pos_native && !pos_twl && !pos_agb) {
             print("Dunno where to set the offsets to the firm paths");
             draw_message("Dunno where to set the offsets to the firm paths",
@@ -247,7 +693,8 @@ int patch_options(void *address, const uint32_t size, const uint8_t options, con
             return 1;
         }
 
-        save_firm = 1;
+        patches_save_firm = 1;
+        if (current_journal) current_journal->save = 1;
 
         uint32_t *pos[] = {pos_native, pos_twl, pos_agb};
         size_t size[] = {
@@ -266,7 +713,8 @@ int patch_options(void *address, const uint32_t size, const uint8_t options, con
         for (unsigned int x = 0; x < sizeof(pos) / sizeof(uint32_t *); x++) {
             if (pos[x]) {
                 uint32_t paddr = 0;
-                char *addr = allocate_memory(&paddr, size[x] + 10);
+                char *addr = allocate_memory(&paddr, size[x] + 10, NATIVE_FIRM, current_firm);
+                if (!addr) return 1;
                 memcpy(addr, L"sdmc:", 10);
                 memcpy(addr + 10, string[x], size[x]);
 
@@ -287,325 +735,746 @@ int patch_options()
 void patch_reset()
 {
 #ifndef STANDALONE
+    // None of the cakes are applied anymore.
+    patches_save_firm = 0;
+
     // Reset the FIRM
-    memcpy(firm_loc, firm_orig_loc, firm_size);
-    if (current_twl_firm) memcpy(twl_firm_loc, twl_firm_orig_loc, twl_firm_size);
-    if (current_agb_firm) memcpy(agb_firm_loc, agb_firm_orig_loc, agb_firm_size);
+    reset_firm(firm_loc, firm_orig_loc, firm_size, &dirty_ranges[NATIVE_FIRM]);
+    if (current_twl_firm) reset_firm(twl_firm_loc, twl_firm_orig_loc, twl_firm_size, &dirty_ranges[TWL_FIRM]);
+    if (current_agb_firm) reset_firm(agb_firm_loc, agb_firm_orig_loc, agb_firm_size, &dirty_ranges[AGB_FIRM]);
+#else
+    for (unsigned int x = 0; x < sizeof(dirty_ranges) / sizeof(*dirty_ranges); x++) {
+        dirty_ranges[x].count = 0;
+    }
 #endif
 
     // Reset memory
     *memory_loc = sizeof(*memory_loc);
     current_memory_loc = memory_loc + 1;
-    for (struct memory_location *location = memory_locations;
-            location->location != 0xFFFFFFFF; location++) {
-        location->used_size = 0;
+    free_memory_count = 0;
+    for (unsigned int x = 0; x < MEMORY_REGION_COUNT; x++) {
+        free_memory_range(memory_regions[x].location, memory_regions[x].location + memory_regions[x].size, x);
     }
-}
-
-int patch_firm(const void *_cake, size_t cake_size)
-{
-    struct cake_header *cake = (struct cake_header *)_cake;
-    uintptr_t cake_end = (uintptr_t)_cake + cake_size;
+    shared_memory_count = 0;
+    memory_used = 0;
 
-    if (cake->version != FORMAT_VERSION) {
-        print("Outdated cake or unknown version");
-        draw_message("Outdated cake or unknown version", "This cake is either outdated or is of an unknown version of the format.");
-        return 1;
+    // Resetting the FIRM put back the original sysmodules.
+    sysmodule_stage_size = 0;
+    for (unsigned int x = 0; x < sizeof(sysmodules_rebuilt) / sizeof(*sysmodules_rebuilt); x++) {
+        sysmodules_rebuilt[x] = 0;
     }
 
-    print("Applying cake:");
-    print(cake->description);
+#ifndef STANDALONE
+    // The FIRM copies ran while we did the above.
+    ndma_copy_wait();
+#endif
+}
 
-    // This struct will be used to store and in the end patch all the locations of the memory patches.
-    struct memory_ids {
-        uint16_t id;
-        uint32_t *patch_location;
-        uint32_t memory_location;
-    } memory_ids[MAX_MEMORY_PATCHES] = {0};
+static struct process9_cache process9_cache;
+static int process9_cache_loaded = 0;
 
-    struct patch *patches = (struct patch *)((uintptr_t)cake + cake->patches_offset);
-    if ((uintptr_t)(patches + cake->patch_count) > cake_end) goto error_bounds;
+static int is_process9(const ncch_h *ncch)
+{
+    // The exheader right behind the NCCH header starts with the name.
+    return ncch->magic == NCCH_MAGIC && memcmp(ncch + 1, "Process9", 8) == 0;
+}
 
-    int applied = 0;
+static void set_process9(firm_section_h *process9, firm_h *firm, ncch_h *ncch)
+{
+    ncch_ex_h *p9exheader = (ncch_ex_h *)(ncch + 1);
+    exefs_h *p9exefs = (exefs_h *)(p9exheader + 1);
 
-    for (struct patch *patch = patches;
-            patch < patches + cake->patch_count; patch++) {
-        void *patch_code = (void *)((uintptr_t)cake + patch->offset);
-        struct patch_version *versions = (struct patch_version *)((uintptr_t)cake + patch->versions_offset);
-        uint32_t *variables = (uint32_t *)((uintptr_t)cake + patch->variables_offset);
+    process9->address = p9exheader->sci.textCodeSet.address;
+    process9->size = p9exefs->fileHeaders[0].size;
+    process9->offset = (uintptr_t)(p9exefs + 1) - (uintptr_t)firm;
+}
 
-        if ((uintptr_t)(patch_code + patch->size) > cake_end ||
-                (uintptr_t)(versions + patch->version_count) > cake_end ||
-                (uintptr_t)(variables + patch->variable_count) > cake_end) {
-            goto error_bounds;
+ncch_h *search_process9(firm_h *firm)
+{
+    for (firm_section_h *section = firm->section;
+            section < firm->section + 4; section++) {
+        // Process9 can only be found in arm9 sections
+        if (section->size == 0 || section->type != FIRM_TYPE_ARM9) continue;
+
+        uintptr_t start = (uintptr_t)firm + section->offset;
+        uintptr_t end = start + section->size - sizeof(ncch_h) - 8;
+        if (section->size < sizeof(ncch_h) + 8) continue;
+
+        // The modules in the arm9bin are normally aligned to media units.
+        for (uintptr_t pos = start; pos <= end; pos += 0x200) {
+            if (is_process9((ncch_h *)pos)) return (ncch_h *)pos;
         }
 
-        struct patch_version *version = NULL;
-        uint32_t *values;
-        void *patch_location = NULL;
+        // If they aren't, look at every word.
+        for (uintptr_t pos = start; pos <= end; pos += 4) {
+            if (is_process9((ncch_h *)pos)) return (ncch_h *)pos;
+        }
+    }
 
-        // Process9 location cache for all the different firms
-        static firm_section_h native_process9;
-        static int native_process9_init;
-        static firm_section_h twl_process9;
-        static int twl_process9_init;
-        static firm_section_h agb_process9;
-        static int agb_process9_init;
+    return NULL;
+}
 
-        // Variables for the current firm
-        firm_h *firm = NULL;
-        struct firm_signature *firm_info = NULL;
-        firm_section_h *process9;
-        int *process9_init;
+// Looks up Process9 in the cache, only searching the FIRM if it's not there yet.
+int find_process9(firm_section_h *process9, firm_h *firm, const enum firm_types firm_type, const struct firm_signature *firm_info)
+{
+    if (!process9_cache_loaded) {
+#ifndef STANDALONE
+        if (read_file(&process9_cache, PATH_PROCESS9, sizeof(process9_cache)) != 0 ||
+                process9_cache.count > MAX_PROCESS9_CACHE) {
+            process9_cache.count = 0;
+        }
+#endif
+        process9_cache_loaded = 1;
+    }
 
-        // For firm and memory patches, we require some additional info.
-        if (patch->type == TYPE_FIRM || patch->type == TYPE_MEMORY || patch->type == TYPE_SYSMODULE) {
-            // Figure out which firm we have to patch
-            switch (patch->firm_type) {
-                case NATIVE_FIRM:
-                    firm = firm_loc;
-                    firm_info = current_firm;
-                    process9 = &native_process9;
-                    process9_init = &native_process9_init;
-                    break;
+    unsigned int x;
+    for (x = 0; x < process9_cache.count; x++) {
+        if (process9_cache.entry[x].firm_type == firm_type &&
+                process9_cache.entry[x].console == firm_info->console &&
+                process9_cache.entry[x].version == firm_info->version) {
+            break;
+        }
+    }
 
-                case TWL_FIRM:
-                    firm = twl_firm_loc;
-                    firm_info = current_twl_firm;
-                    process9 = &twl_process9;
-                    process9_init = &twl_process9_init;
-                    break;
+    if (x < process9_cache.count) {
+        // Make sure it's still right, in case the FIRM was swapped for a different dump.
+        // The cache comes from the SD card, so it has to be within the FIRM before we look at it.
+        uint32_t offset = process9_cache.entry[x].offset;
+        uint32_t end = firm_end(firm, 0);
+        if (offset >= sizeof(ncch_h) + sizeof(ncch_ex_h) + sizeof(exefs_h) && offset <= end &&
+                process9_cache.entry[x].size <= end - offset) {
+            ncch_h *ncch = (ncch_h *)((uintptr_t)firm + offset - sizeof(exefs_h) - sizeof(ncch_ex_h) - sizeof(ncch_h));
+            if (is_process9(ncch)) {
+                process9->offset = offset;
+                process9->address = process9_cache.entry[x].address;
+                process9->size = process9_cache.entry[x].size;
+                return 0;
+            }
+        }
+    }
 
-                case AGB_FIRM:
-                    firm = agb_firm_loc;
-                    firm_info = current_agb_firm;
-                    process9 = &agb_process9;
-                    process9_init = &agb_process9_init;
-                    break;
+    print("Looking for Process9");
+    ncch_h *ncch = search_process9(firm);
+    if (!ncch) return 1;
+    set_process9(process9, firm, ncch);
 
-                default:
-                    print("Unsupported FIRM type");
-                    draw_message("Unsupported FIRM type", "This cake uses an unknown or unsupported FIRM type.");
-                    return 1;
-            }
+    // Replace the stale entry, or add one if there's still space.
+    if (x == process9_cache.count) {
+        if (x >= MAX_PROCESS9_CACHE) return 0;
+        process9_cache.count++;
+    }
+    process9_cache.entry[x].firm_type = firm_type;
+    process9_cache.entry[x].console = firm_info->console;
+    process9_cache.entry[x].version = firm_info->version;
+    process9_cache.entry[x].offset = process9->offset;
+    process9_cache.entry[x].address = process9->address;
+    process9_cache.entry[x].size = process9->size;
 
-            if (!firm_info) {
-                print("FIRM not loaded");
-                draw_message("FIRM not loaded", "The FIRM this cake tries to patch isn't loaded.\nPlease make sure it's installed correctly and is loaded.");
-                return 1;
-            }
+#ifndef STANDALONE
+    write_file(&process9_cache, PATH_PROCESS9, sizeof(process9_cache));
+#endif
 
-            // Look for the correct patch version info
-            for (struct patch_version *patch_version = versions;
-                    patch_version < versions + patch->version_count; patch_version++) {
-                if (patch_version->console == firm_info->console &&
-                        patch_version->firm_version == firm_info->version) {
-                    version = patch_version;
-                    break;
-                }
-            }
+    return 0;
+}
 
-            if (!version) {
-                // This specific patch doesn't support this FIRM version,
-                //  but a different one might.
-                continue;
+// Look up the version of a patch that matches the given FIRM.
+// Newer cakes keep the versions sorted by identifier, older ones need a linear scan.
+static struct patch_version *find_version(void *versions, const uint8_t count, const uint32_t size,
+        const uint8_t options, const struct firm_signature *firm_info)
+{
+    uint32_t identifier = firm_info->console << 16 | firm_info->version;
+
+    if (options & patch_option_sorted) {
+        unsigned int low = 0;
+        unsigned int high = count;
+        while (low < high) {
+            unsigned int middle = (low + high) / 2;
+            if (VERSION_AT(versions, size, middle)->version < identifier) {
+                low = middle + 1;
+            } else {
+                high = middle;
             }
+        }
 
-            // Apply all the variables for this version
-            values = (uint32_t *)((uintptr_t)cake + version->values_offset);
-            if ((uintptr_t)(values + patch->variable_count) > cake_end) goto error_bounds;
+        if (low < count && VERSION_AT(versions, size, low)->version == identifier) {
+            return VERSION_AT(versions, size, low);
+        }
+        return NULL;
+    }
 
-            for (int x = 0; x < patch->variable_count; x++) {
-                if (variables[x] > patch->size) goto error_bounds;
-                *(uint32_t *)(patch_code + variables[x]) = values[x];
-            }
+    for (unsigned int x = 0; x < count; x++) {
+        if (VERSION_AT(versions, size, x)->version == identifier) {
+            return VERSION_AT(versions, size, x);
         }
+    }
+    return NULL;
+}
 
-        // Depending on the type, we have to use it in a different way
-        if (patch->type == TYPE_FIRM) {
-            // Look for Process9
-            if (!*process9_init) {
-                // Look for process9 in all sections
-                for (firm_section_h *section = firm->section;
-                        section < firm->section + 4; section++) {
-                    if (section->size == 0) {
-                        // This section doesn't exist
-                        continue;
-                    } else if (section->type != FIRM_TYPE_ARM9) {
-                        // Process9 can only be found in arm9 sections
-                        continue;
-                    }
+// Get the location of a patch from a file offset resolved by patissier.py.
+// It's only trusted if it's where the section holding the patch's address puts it, so a cake built
+//   for another dump of this version doesn't land somewhere else. Process9 isn't looked up for this.
+// Returns NULL otherwise, so we can fall back to translating the address.
+static void *resolve_file_offset(firm_h *firm, const uint32_t address, const uint32_t offset, const uint32_t size)
+{
+    for (int x = 0; x < 4; x++) {
+        firm_section_h *section = &firm->section[x];
+        if (!section->size || address < section->address || address - section->address >= section->size) continue;
 
-                    // Look for the string "Process9" in this section
-                    for (uint32_t *arm9section = (uint32_t *)((uintptr_t)firm + section->offset);
-                            arm9section < (uint32_t *)((uintptr_t)firm + section->offset + section->size);
-                            arm9section++) {
-                        if (arm9section[0] == 0x636F7250 && arm9section[1] == 0x39737365) {
-                            ncch_h *ncch = (ncch_h *)((uintptr_t)arm9section - sizeof(ncch_h));
-                            if (ncch->magic == NCCH_MAGIC) {
-                                // Found Process9
-                                ncch_ex_h *p9exheader = (ncch_ex_h *)(ncch + 1);
-                                exefs_h *p9exefs = (exefs_h *)(p9exheader + 1);
-
-                                process9->address = p9exheader->sci.textCodeSet.address;
-                                process9->size = p9exefs->fileHeaders[0].size;
-                                process9->offset = (uintptr_t)(p9exefs + 1) - (uintptr_t)firm;
-
-                                (*process9_init)++;
-                                goto found_process9;
-                            }
-                        }
-                    }
-                }
-                print("Couldn't find Process9");
-                draw_message("Couldn't find Process9", "Process9 couldn't be found on your FIRM. This is a bug.");
-                return 1;
-            }
-found_process9:;
+        uint32_t position = address - section->address;
+        if (offset != section->offset + position || size > section->size - position) return NULL;
+        return (void *)((uintptr_t)firm + offset);
+    }
+    return NULL;
+}
 
-            // Look for the location in the FIRM to apply the patch
-            int x;
-            for (x = 0; x < 5; x++) {
-                firm_section_h *section;
+// Get the entry for a memory ID, or the empty slot it goes in.
+// The table is a power of two in size and never more than half full.
+static struct memory_id *get_memory_id(struct memory_id *table, const uint32_t mask, const uint16_t id)
+{
+    uint32_t index = id & mask;
+    while (table[index].id && table[index].id != id) {
+        index = (index + 1) & mask;
+    }
+    return &table[index];
+}
 
-                // Try process9 before anything else
-                if (x == 0) {
-                    section = process9;
-                } else {
-                    section = &firm->section[x - 1];
+// Copy a patch to where it goes, decompressing it there if needed, and fill in its variables.
+static int place_patch(void *dest, const struct patch *patch, const void *code, const uint32_t code_size,
+        const uint32_t *variables, const uint32_t *values)
+{
+    memcpy(dest, code, code_size);
 
-                    // Stop scanning at the end of the section list
-                    if (section->address == 0) {
-                        break;
-                    }
-                }
+    if (patch->options & patch_option_compressed) {
+#ifndef STANDALONE
+        static uint32_t blz_ticks = 0, blz_in = 0, blz_out = 0;
+        uint32_t start = trace_ticks();
+#endif
 
-                if (version->offset >= section->address &&
-                        version->offset < section->address + section->size) {
-                    patch_location = (void *)((uintptr_t)firm + section->offset + (version->offset - section->address));
+        if (blz_decompress(dest, code_size, patch->size) != 0) {
+            print("Failed to decompress patch");
+            draw_message("Failed to decompress patch", "A patch in this cake is compressed, but it couldn't be decompressed.\nThe cake is probably corrupted.");
+            return 1;
+        }
 
-                    // Apply the patch
-                    memcpy(patch_location, patch_code, patch->size);
+#ifndef STANDALONE
+        // Compare the time this takes with the time saved reading the cake.
+        blz_ticks += trace_ticks() - start;
+        blz_in += code_size;
+        blz_out += patch->size;
+        trace_count("blz ticks", blz_ticks);
+        trace_count("blz bytes in", blz_in);
+        trace_count("blz bytes out", blz_out);
+#endif
+    }
 
-                    // Apply whatever options it needs
-                    if (patch->options) {
-                        if (patch_options(patch_location, patch->size, patch->options, patch->type) != 0) {
-                            return 1;
-                        }
-                    }
+    for (int x = 0; x < patch->variable_count; x++) {
+        *(uint32_t *)(dest + variables[x]) = values[x];
+    }
 
-                    break;
-                }
-            }
+    return 0;
+}
 
-            if (x >= 5) {
-                print("Failed to apply patch");
+// Where the last section of a FIRM ends, if that's past the given size.
+size_t firm_end(const firm_h *firm, size_t size)
+{
+    for (int x = 0; x < 4; x++) {
+        const firm_section_h *section = &firm->section[x];
+        if (section->size && section->offset + section->size > size) {
+            size = section->offset + section->size;
+        }
+    }
+    return size;
+}
+
+// Makes room for a sysmodule in the staging area, for the cake that's being applied.
+static struct staged_sysmodule *stage_sysmodule(const enum firm_types firm_type, const uint32_t size)
+{
+    struct staged_sysmodule *staged = (void *)sysmodule_stage + sysmodule_stage_size;
+    if (sysmodule_stage_size + sizeof(*staged) + size > SYSMODULE_STAGE_SIZE) {
+        print("Too many sysmodules");
+        draw_message("Too many sysmodules", "The sysmodules the selected cakes replace or add don't fit in memory.");
+        return NULL;
+    }
+
+    staged->size = size;
+    staged->firm_type = firm_type;
+    staged->used = 0;
+#ifndef STANDALONE
+    staged->cake = current_journal ? current_journal - cake_journal : 0;
+#else
+    staged->cake = 0;
+#endif
+
+    sysmodule_stage_size += sizeof(*staged) + size;
+    return staged;
+}
+
+// The FIRM as it was loaded, before any cake was applied.
+static const firm_h *original_firm(const enum firm_types firm_type)
+{
+    const firm_h *firms_orig[] = {firm_orig_loc, twl_firm_orig_loc, agb_firm_orig_loc};
+    return firms_orig[firm_type];
+}
+
+// Finds a module in the sysmodule section of a FIRM.
+static const ncch_h *find_sysmodule(const firm_h *firm, const uint8_t *program_id)
+{
+    const void *modules = (void *)firm + firm->section[0].offset;
+    const uint32_t size = firm->section[0].size;
+
+    uint32_t offset = 0;
+    while (size - offset >= sizeof(ncch_h)) {
+        const ncch_h *module = modules + offset;
+        uint32_t module_size = module->contentSize * 0x200;
+        if (module->magic != NCCH_MAGIC || !module_size || module_size > size - offset) break;
+
+        if (memcmp(module->programID, program_id, 8) == 0) return module;
+        offset += module_size;
+    }
+
+    return NULL;
+}
+
+// Checks that what a delta is about to be applied to is what it was made from.
+static int delta_source_matches(const struct delta_header *delta, const void *source, const uint32_t size)
+{
+    uint8_t hash[SHA_256_HASH_SIZE];
+
+    if (size != delta->source_size) return 0;
+    sha(hash, source, size, SHA_256_MODE);
+    return memcmp(hash, delta->source_hash, sizeof(hash)) == 0;
+}
+
+// Applies a delta to one of the original sysmodules, or one of the other FIRM sections.
+// Either way it starts from the original FIRM, so any other patch to what it changes has to come after it.
+static int apply_delta(const enum firm_types firm_type, firm_h *firm, const unsigned int section_index,
+        const struct delta_header *delta, const uint32_t size)
+{
+    const firm_h *firm_orig = original_firm(firm_type);
+    const void *commands = delta + 1;
+    const uint32_t commands_size = size - sizeof(*delta);
+
+    if (section_index == 0) {
+        // Sysmodules are staged like any other, the result has to be a whole module.
+        const ncch_h *source = find_sysmodule(firm_orig, delta->program_id);
+        if (!source) {
+            print("Sysmodule not found");
+            draw_message("Sysmodule not found", "The sysmodule this cake changes isn't in your FIRM.");
+            return 1;
+        }
+        if (!delta_source_matches(delta, source, source->contentSize * 0x200)) goto error_source;
+        if (delta->target_size < sizeof(ncch_h) || delta->target_size % 0x200) goto error_corrupted;
+
+        struct staged_sysmodule *staged = stage_sysmodule(firm_type, delta->target_size);
+        if (!staged) return 1;
+
+        if (delta_apply(staged + 1, delta->target_size, source, delta->source_size, commands, commands_size) != 0 ||
+                ((ncch_h *)(staged + 1))->contentSize * 0x200 != delta->target_size) {
+            sysmodule_stage_size -= sizeof(*staged) + staged->size;
+            goto error_corrupted;
+        }
+
+        return 0;
+    }
+
+    // The sysmodule section may be laid out again, so other sections can only be changed in place,
+    //   and they never move.
+    if (section_index >= 4 || !firm_orig->section[section_index].size ||
+            firm->section[section_index].offset != firm_orig->section[section_index].offset ||
+            firm->section[section_index].size != firm_orig->section[section_index].size) {
+        goto error_source;
+    }
+
+    const void *source = (void *)firm_orig + firm_orig->section[section_index].offset;
+    void *section = (void *)firm + firm->section[section_index].offset;
+    if (!delta_source_matches(delta, source, firm_orig->section[section_index].size)) goto error_source;
+    if (delta->target_size != delta->source_size) goto error_corrupted;
+
+    // It replaces the whole section, so it would undo anything patched in there before it.
+    if (memcmp(section, source, delta->source_size) != 0) {
+        print("Section already patched");
+        draw_message("Section already patched",
+                "Another patch changed the FIRM section this cake's delta replaces.\n"
+                "  Deltas have to be applied before any other patch\n"
+                "  to the same section.");
+        return 1;
+    }
+
+    mark_dirty(firm_type, firm, section, delta->target_size);
+    if (delta_apply(section, delta->target_size, source, delta->source_size, commands, commands_size) != 0) {
+        goto error_corrupted;
+    }
+
+    return 0;
+
+error_source:
+    print("Delta doesn't match");
+    draw_message("Delta doesn't match", "What this cake's delta changes in your FIRM isn't what the delta was made from.");
+    return 1;
+
+error_corrupted:
+    print("Failed to apply delta");
+    draw_message("Failed to apply delta", "A delta in this cake couldn't be applied.\nThe cake is probably corrupted.");
+    return 1;
+}
+
+// Finds the last staged version of a sysmodule, and marks all of them as laid out.
+static struct staged_sysmodule *find_staged_sysmodule(const enum firm_types firm_type, const uint8_t *program_id)
+{
+    struct staged_sysmodule *found = NULL;
+
+    for (void *pos = sysmodule_stage; pos < (void *)sysmodule_stage + sysmodule_stage_size;
+            pos += sizeof(struct staged_sysmodule) + ((struct staged_sysmodule *)pos)->size) {
+        struct staged_sysmodule *staged = pos;
+        if (staged->firm_type == firm_type && memcmp(((ncch_h *)(staged + 1))->programID, program_id, 8) == 0) {
+            staged->used = 1;
+            found = staged;
+        }
+    }
+
+    return found;
+}
+
+static int append_sysmodule(uint32_t *size, const uint32_t limit, const void *module, const uint32_t module_size)
+{
+    if (module_size > limit - *size) {
+        print("Sysmodules too big");
+        draw_message("Sysmodules too big", "The sysmodules the selected cakes replace or add don't fit in memory.");
+        return 1;
+    }
+
+    memcpy((void *)sysmodule_scratch + *size, module, module_size);
+    *size += module_size;
+    return 0;
+}
+
+// Lays out the sysmodule section of a FIRM in a single pass, from its current modules and the staged ones.
+// Replaced modules keep their place, new ones go at the end.
+// The FIRM patches cakes made to the modules stay, except for those to a module that's replaced.
+static int rebuild_sysmodule_section(const enum firm_types firm_type, firm_h *firm, const firm_h *firm_orig)
+{
+    unsigned int staged_count = 0;
+    for (void *pos = sysmodule_stage; pos < (void *)sysmodule_stage + sysmodule_stage_size;
+            pos += sizeof(struct staged_sysmodule) + ((struct staged_sysmodule *)pos)->size) {
+        struct staged_sysmodule *staged = pos;
+        if (staged->firm_type == firm_type) {
+            staged->used = 0;
+            staged_count++;
+        }
+    }
+
+    // Leave the section alone if no cake changes its modules.
+    if (!staged_count) return 0;
+
+    // It seems safe to assume that the first section contains the sysmodules.
+    const uint32_t orig_offset = firm_orig->section[0].offset;
+    const uint32_t orig_size = firm_orig->section[0].size;
+    const uint32_t orig_end = firm_end(firm_orig, 0);
+
+    // The section is built where it ends up, so set the current one aside at the end of the scratch buffer.
+    const uint32_t current_size = firm->section[0].size;
+    if (current_size > SYSMODULE_SCRATCH_SIZE) goto error_size;
+    const uint32_t limit = SYSMODULE_SCRATCH_SIZE - current_size;
+    void *modules = (void *)sysmodule_scratch + limit;
+    memcpy(modules, (void *)firm + firm->section[0].offset, current_size);
+
+    uint32_t size = 0;
+    uint32_t offset = 0;
+    while (current_size - offset >= sizeof(ncch_h)) {
+        const ncch_h *module = modules + offset;
+        uint32_t module_size = module->contentSize * 0x200;
+        if (module->magic != NCCH_MAGIC || !module_size || module_size > current_size - offset) break;
+
+        struct staged_sysmodule *staged = find_staged_sysmodule(firm_type, module->programID);
+        if (staged) {
+            if (append_sysmodule(&size, limit, staged + 1, staged->size) != 0) return 1;
+        } else {
+            if (append_sysmodule(&size, limit, module, module_size) != 0) return 1;
+        }
+
+        offset += module_size;
+    }
+
+    for (void *pos = sysmodule_stage; pos < (void *)sysmodule_stage + sysmodule_stage_size;
+            pos += sizeof(struct staged_sysmodule) + ((struct staged_sysmodule *)pos)->size) {
+        struct staged_sysmodule *staged = pos;
+        if (staged->firm_type != firm_type || staged->used) continue;
+
+        staged = find_staged_sysmodule(firm_type, ((ncch_h *)(staged + 1))->programID);
+        if (append_sysmodule(&size, limit, staged + 1, staged->size) != 0) return 1;
+    }
+
+    // Whatever followed the modules stays behind them.
+    if (append_sysmodule(&size, limit, modules + offset, current_size - offset) != 0) return 1;
+
+    // If it doesn't fit where it was originally, put it after everything else, so nothing else moves.
+    // Either way, it has to end within the space the FIRM has.
+    uint32_t section_offset = orig_offset;
+    if (size > orig_size) section_offset = (orig_end + 0x1FF) & ~0x1FF;
+    if (section_offset > firm_capacity[firm_type] || size > firm_capacity[firm_type] - section_offset) {
+        goto error_size;
+    }
+
+    // Resetting the FIRM clears whatever is past the end of the original.
+    mark_dirty(firm_type, firm, (void *)firm + section_offset, size);
+    mark_dirty(firm_type, firm, &firm->section[0], sizeof(firm_section_h));
+
+    memcpy((void *)firm + section_offset, sysmodule_scratch, size);
+    firm->section[0].offset = section_offset;
+    firm->section[0].size = size;
+    sha(firm->section[0].hash, sysmodule_scratch, size, SHA_256_MODE);
+
+    sysmodules_rebuilt[firm_type] = 1;
+    return 0;
+
+error_size:
+    print("Sysmodules too big");
+    draw_message("Sysmodules too big", "The sysmodules the selected cakes replace or add don't fit in the FIRM.");
+    return 1;
+}
+
+// Puts the sysmodules of the applied cakes in their FIRMs.
+int rebuild_sysmodules()
+{
+    firm_h *firms[] = {firm_loc, twl_firm_loc, agb_firm_loc};
+    const struct firm_signature *firms_info[] = {current_firm, current_twl_firm, current_agb_firm};
+
+    for (unsigned int x = NATIVE_FIRM; x <= AGB_FIRM; x++) {
+        if (!firms_info[x]) continue;
+        if (rebuild_sysmodule_section(x, firms[x], original_firm(x)) != 0) return 1;
+    }
+
+    return 0;
+}
+
+int patch_firm(const void *_cake, size_t cake_size)
+{
+    struct cake_header *cake = (struct cake_header *)_cake;
+    uintptr_t cake_end = (uintptr_t)_cake + cake_size;
+
+    if (cake->version < MIN_FORMAT_VERSION || cake->version > FORMAT_VERSION) {
+        print("Outdated cake or unknown version");
+        draw_message("Outdated cake or unknown version", "This cake is either outdated or is of an unknown version of the format.");
+        return 1;
+    }
+
+    print("Applying cake:");
+    print(cake->description);
+
+    // Every memory ID and FIRM hook in this cake, to point the hooks at the memory patches in the end.
+    // They're too big for the stack with a lot of patches.
+    uint32_t memory_ids_size = 1;
+    while (memory_ids_size < cake->patch_count * 2u) memory_ids_size <<= 1;
+    struct memory_id *memory_ids = patch_tables->memory_ids;
+    memset(memory_ids, 0, memory_ids_size * sizeof(*memory_ids));
+
+    struct memory_hook *hooks = patch_tables->hooks;
+    unsigned int hook_count = 0;
+
+    struct patch *patches = (struct patch *)((uintptr_t)cake + cake->patches_offset);
+    if ((uintptr_t)(patches + cake->patch_count) > cake_end) goto error_bounds;
+
+    const uint32_t version_size = VERSION_SIZE(cake->version);
+    int applied = 0;
+
+    for (struct patch *patch = patches;
+            patch < patches + cake->patch_count; patch++) {
+        void *patch_code = (void *)((uintptr_t)cake + patch->offset);
+        void *versions = (void *)((uintptr_t)cake + patch->versions_offset);
+        uint32_t *variables = (uint32_t *)((uintptr_t)cake + patch->variables_offset);
+
+        // Compressed patches start with their size in the cake, and never grow when decompressing.
+        uint32_t code_size = patch->size;
+        if (patch->options & patch_option_compressed) {
+            if ((uintptr_t)patch_code + sizeof(uint32_t) > cake_end) goto error_bounds;
+            code_size = *(uint32_t *)patch_code;
+            patch_code += sizeof(uint32_t);
+            if (code_size > patch->size) goto error_bounds;
+        }
+
+        if ((uintptr_t)(patch_code + code_size) > cake_end ||
+                (uintptr_t)versions + patch->version_count * version_size > cake_end ||
+                (uintptr_t)(variables + patch->variable_count) > cake_end) {
+            goto error_bounds;
+        }
+
+        struct patch_version *version = NULL;
+        uint32_t *values = NULL;
+        void *patch_location = NULL;
+
+        // Variables for the current firm
+        firm_h *firm = NULL;
+        struct firm_signature *firm_info = NULL;
+        firm_section_h process9;
+
+        // For firm and memory patches, we require some additional info.
+        if (patch->type == TYPE_FIRM || patch->type == TYPE_MEMORY ||
+                patch->type == TYPE_SYSMODULE || patch->type == TYPE_DELTA) {
+            // Figure out which firm we have to patch
+            switch (patch->firm_type) {
+                case NATIVE_FIRM:
+                    firm = firm_loc;
+                    firm_info = current_firm;
+                    break;
+
+                case TWL_FIRM:
+                    firm = twl_firm_loc;
+                    firm_info = current_twl_firm;
+                    break;
+
+                case AGB_FIRM:
+                    firm = agb_firm_loc;
+                    firm_info = current_agb_firm;
+                    break;
+
+                default:
+                    print("Unsupported FIRM type");
+                    draw_message("Unsupported FIRM type", "This cake uses an unknown or unsupported FIRM type.");
+                    return 1;
+            }
+
+            if (!firm_info) {
+                print("FIRM not loaded");
+                draw_message("FIRM not loaded", "The FIRM this cake tries to patch isn't loaded.\nPlease make sure it's installed correctly and is loaded.");
+                return 1;
+            }
+
+            // Look for the correct patch version info
+            version = find_version(versions, patch->version_count, version_size, patch->options, firm_info);
+            if (!version) {
+                // This specific patch doesn't support this FIRM version,
+                //  but a different one might.
+                continue;
+            }
+
+            // Get all the variables for this version, they're filled in once the patch is in place.
+            values = (uint32_t *)((uintptr_t)cake + version->values_offset);
+            if ((uintptr_t)(values + patch->variable_count) > cake_end) goto error_bounds;
+
+            for (int x = 0; x < patch->variable_count; x++) {
+                if (variables[x] > patch->size) goto error_bounds;
+            }
+        }
+
+        // Depending on the type, we have to use it in a different way
+        if (patch->type == TYPE_FIRM) {
+            // Newer cakes may already know where the patch goes in this FIRM.
+            if (version_size == sizeof(struct patch_version) && version->file_offset) {
+                patch_location = resolve_file_offset(firm, version->offset, version->file_offset, patch->size);
+            }
+
+            if (!patch_location) {
+                // Look for Process9
+                if (find_process9(&process9, firm, patch->firm_type, firm_info) != 0) {
+                    print("Couldn't find Process9");
+                    draw_message("Couldn't find Process9", "Process9 couldn't be found on your FIRM. This is a bug.");
+                    return 1;
+                }
+
+                // Look for the location in the FIRM to apply the patch
+                for (int x = 0; x < 5; x++) {
+                    firm_section_h *section;
+
+                    // Try process9 before anything else
+                    if (x == 0) {
+                        section = &process9;
+                    } else {
+                        section = &firm->section[x - 1];
+
+                        // Stop scanning at the end of the section list
+                        if (section->address == 0) {
+                            break;
+                        }
+                    }
+
+                    if (version->offset >= section->address &&
+                            version->offset < section->address + section->size) {
+                        patch_location = (void *)((uintptr_t)firm + section->offset + (version->offset - section->address));
+                        break;
+                    }
+                }
+            }
+
+            if (!patch_location) {
+                print("Failed to apply patch");
                 draw_message("Failed to apply patch", "The location where the patch should be applied could not be found");
                 return 1;
             }
 
+            // Apply the patch
+            // Any options and memory hooks only write inside of the patch itself.
+            mark_dirty(patch->firm_type, firm, patch_location, patch->size);
+            if (place_patch(patch_location, patch, patch_code, code_size, variables, values) != 0) {
+                return 1;
+            }
+
+            // Apply whatever options it needs
+            if (patch->options & PATCH_OPTIONS_APPLIED) {
+                if (patch_options(patch_location, patch->size, patch->options, patch->type) != 0) {
+                    return 1;
+                }
+            }
+
         } else if (patch->type == TYPE_MEMORY) {
             // Allocate memory for the patch
-            void *memory = allocate_memory((uint32_t *)&patch_location, patch->size);
+            void *memory = allocate_memory((uint32_t *)&patch_location, patch->size, patch->firm_type, firm_info);
             if (!memory) return 1;
 
             // Copy the code
-            memcpy(memory, patch_code, patch->size);
+            if (place_patch(memory, patch, patch_code, code_size, variables, values) != 0) {
+                return 1;
+            }
 
             // Apply whatever options it needs
-            if (patch->options) {
+            if (patch->options & PATCH_OPTIONS_APPLIED) {
                 if (patch_options(memory, patch->size, patch->options, patch->type) != 0) {
                     return 1;
                 }
             }
 
-        } else if (patch->type == TYPE_SYSMODULE) {
-            // It seems safe to assume that the first section contains the sysmodules.
-            firm_section_h *sysmodule_section = &firm->section[0];
-
-            ncch_h *module = patch_code;
-            ncch_h *sysmodule = (ncch_h *)((uintptr_t)firm + sysmodule_section->offset);
-
-            // Check if we want to replace an existing sysmodule
-            while (sysmodule->magic == NCCH_MAGIC) {
-                if (memcmp(sysmodule->programID, module->programID, 8) == 0) {
-                    if (module->contentSize > sysmodule->contentSize) {
-                        // TODO: Expanding a module's size isn't supported yet...
-                        continue;
-                    }
-
-                    // Move the remaining modules closer
-                    if (module->contentSize < sysmodule->contentSize) {
-                        int remaining_size = sysmodule_section->size - (((uintptr_t)sysmodule + sysmodule->contentSize * 0x200) - ((uintptr_t)firm + sysmodule_section->offset));
-                        memmove((char *)sysmodule + module->contentSize * 0x200, (char *)sysmodule + sysmodule->contentSize * 0x200, remaining_size);
-                    }
-
-                    // Copy the module into the firm
-                    memcpy(sysmodule, module, module->contentSize * 0x200);
+            // Another cake may have installed the very same code already.
+            share_memory(memory, (uint32_t *)&patch_location, patch->firm_type, firm_info);
 
-                    break;
-                }
-
-                sysmodule = (ncch_h *)((uintptr_t)sysmodule + sysmodule->contentSize * 0x200);
+        } else if (patch->type == TYPE_SYSMODULE) {
+            // Compressed modules keep their header as-is.
+            const ncch_h *module = patch_code;
+            if (code_size < sizeof(ncch_h) || module->contentSize * 0x200 != patch->size) goto error_bounds;
+
+            // Every cake's sysmodules are collected first, rebuild_sysmodules() lays them out all at once.
+            struct staged_sysmodule *staged = stage_sysmodule(patch->firm_type, patch->size);
+            if (!staged) return 1;
+            if (place_patch(staged + 1, patch, patch_code, code_size, variables, values) != 0) {
+                return 1;
             }
 
-            // TODO: Adding a new sysmodule is not supported yet...
-            if (sysmodule->magic != NCCH_MAGIC) {
-                print("Unuspported feature");
-                draw_message("Unsupported feature", "This CakesFW version doesn't support injecting bigger sysmodules than those available or adding new ones yet.");
-                return 1;
+        } else if (patch->type == TYPE_DELTA) {
+            // Deltas are applied straight from the original into where the result goes.
+            const struct delta_header *delta = patch_code;
+            if (code_size < sizeof(*delta) || patch->variable_count ||
+                    (patch->options & patch_option_compressed)) {
+                goto error_bounds;
             }
 
+            if (apply_delta(patch->firm_type, firm, patch->section, delta, code_size) != 0) return 1;
+
         } else {
             print("Unsupported patch type");
             draw_message("Unsupported patch type", "This cake uses an unknown or unsupported patch type.");
             return 1;
         }
 
-        // For firm and memory patches, add some info to the memory_ids array.
-        if ((patch->type == TYPE_FIRM && patch->memory_id) || patch->type == TYPE_MEMORY) {
-            struct memory_ids *copy_id = NULL;
-            int found = 0;
-            struct memory_ids *memory_id;
-            // Look for the correct memory_id
-            for (memory_id = memory_ids;
-                    memory_id < memory_ids + MAX_MEMORY_PATCHES && memory_id->id;
-                    memory_id++) {
-                if (memory_id->id == patch->memory_id) {
-                    // We found the entry.
-                    found++;
-
-                    if (patch->type == TYPE_FIRM) {
-                        // If this hook has already been set, copy the current one memory_id and look for more.
-                        if (memory_id->patch_location) {
-                            copy_id = memory_id;
-                            continue;
-                        }
-                        memory_id->patch_location = patch_location + patch->memory_offset;
-                        break;
-                    } else {
-                        memory_id->memory_location = (uintptr_t)patch_location;
-                    }
-                }
-            }
-
-            if (memory_id >= memory_ids + MAX_MEMORY_PATCHES) {
-                // If we stopped looping because there's no more room, end.
-                print("Too many memory patches");
-                draw_message("Too many memory patches", "This cake contains too many different memory ids. We can't hold them all.");
-                return 1;
-            } else if (!memory_id->id && (!found || copy_id)) {
-                // Else, create a new entry.
-                memory_id->id = patch->memory_id;
-                // Fill the data we need.
-                if (patch->type == TYPE_FIRM) {
-                    if (copy_id) {
-                        memory_id->memory_location = copy_id->memory_location;
-                    }
-                    memory_id->patch_location = patch_location + patch->memory_offset;
-                } else {
-                    memory_id->memory_location = (uintptr_t)patch_location;
-                }
+        // For firm and memory patches, add some info to the memory_ids table.
+        if ((patch->type == TYPE_FIRM || patch->type == TYPE_MEMORY) && patch->memory_id) {
+            struct memory_id *memory_id = get_memory_id(memory_ids, memory_ids_size - 1, patch->memory_id);
+            memory_id->id = patch->memory_id;
+
+            if (patch->type == TYPE_FIRM) {
+                hooks[hook_count].id = patch->memory_id;
+                hooks[hook_count].location = patch_location + patch->memory_offset;
+                hook_count++;
+                memory_id->hooked = 1;
+            } else {
+                memory_id->location = (uintptr_t)patch_location;
             }
         }
 
@@ -622,16 +1491,17 @@ found_process9:;
     }
 
     // Make all the hook patches point to the right memory location.
-    for (struct memory_ids *memory_id = memory_ids;
-            memory_id < memory_ids + MAX_MEMORY_PATCHES && memory_id->id;
-            memory_id++) {
-        if (!memory_id->patch_location || !memory_id->memory_location) {
+    for (struct memory_id *memory_id = memory_ids;
+            memory_id < memory_ids + memory_ids_size; memory_id++) {
+        if (memory_id->id && (!memory_id->hooked || !memory_id->location)) {
             print("Missing hook or memory patch");
             draw_message("Missing hook or memory patch", "This cake lacks either a memory patch or a hook.");
             return 1;
         }
+    }
 
-        *memory_id->patch_location = memory_id->memory_location;
+    for (struct memory_hook *hook = hooks; hook < hooks + hook_count; hook++) {
+        *hook->location = get_memory_id(memory_ids, memory_ids_size - 1, hook->id)->location;
     }
 
     return 0;
@@ -643,40 +1513,390 @@ error_bounds:
 }
 
 #ifndef STANDALONE
+// Check if a cake has at least one patch that can be applied to the FIRMs we have,
+//   and that all the FIRMs it patches are there.
+static int cake_applicable(const struct catalog_entry *entry)
+{
+    struct firm_signature *firms[] = {current_firm, current_twl_firm, current_agb_firm};
+    unsigned int unknown = 0;
+
+    for (unsigned int type = NATIVE_FIRM; type <= AGB_FIRM; type++) {
+        if (!(entry->patch_firm_types & (1 << type)) || firms[type]) continue;
+
+        // A FIRM we tried to load and failed, patch_firm() would refuse to patch it.
+        if (firms_attempted & (1 << type)) return 0;
+
+        // TWL_FIRM and AGB_FIRM are loaded lazily, so only look at their header for now.
+        if (peek_firm(type, &firms[type]) != 0) return 0;
+
+        // It's still encrypted, so we only know the version once it's loaded.
+        if (!firms[type]) unknown |= 1 << type;
+    }
+
+    for (unsigned int x = 0; x < entry->version_count; x++) {
+        unsigned int type = entry->versions[x] >> 24;
+        if (type > AGB_FIRM) continue;
+        if (unknown & (1 << type)) return 1;
+
+        const struct firm_signature *firm_info = firms[type];
+        if (firm_info && (entry->versions[x] & 0xFFFFFF) == ((uint32_t)firm_info->console << 16 | firm_info->version)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int apply_cake(const unsigned int index)
+{
+    struct cake_journal *journal = &cake_journal[index];
+
+    unsigned int span = trace_begin("read_cake");
+    int status = read_file(firm_patch_temp, cake_list[index].path, FCRAM_SPACING * 2);
+    trace_end(span);
+    if (status != 0) {
+        print("Failed to load patch");
+        draw_message("Failed to load patch", "Please make sure all the patches you want\n  to apply actually exist on the SD card.");
+        return 1;
+    }
+
+    journal->range_count = 0;
+    journal->complete = 1;
+    journal->save = 0;
+    journal->memory_start = *memory_loc;
+
+    current_journal = journal;
+    status = patch_firm(firm_patch_temp, FCRAM_SPACING * 2);
+    current_journal = NULL;
+
+    if (status != 0) {
+        // The cake may have been applied halfway, start from scratch next time.
+        journal_valid = 0;
+        return 1;
+    }
+
+    journal->memory_end = *memory_loc;
+    journal->applied = 1;
+    return 0;
+}
+
+int unapply_cake(const unsigned int index)
+{
+    struct cake_journal *journal = &cake_journal[index];
+    firm_h *firms[] = {firm_loc, twl_firm_loc, agb_firm_loc};
+    firm_h *firms_orig[] = {firm_orig_loc, twl_firm_orig_loc, agb_firm_orig_loc};
+
+    if (!journal->complete) return 1;
+
+    // Memory patches can only be dropped if nothing has been allocated after them.
+    if (journal->memory_start != journal->memory_end && journal->memory_end != *memory_loc) return 1;
+
+    // Nor if another cake is using one of them.
+    for (unsigned int x = 0; x < shared_memory_count; x++) {
+        if (shared_memory[x] >= journal->memory_start && shared_memory[x] < journal->memory_end) return 1;
+    }
+
+    // The next sysmodule section is laid out from the current one, which would keep the modules it brought.
+    for (void *pos = sysmodule_stage; pos < (void *)sysmodule_stage + sysmodule_stage_size;
+            pos += sizeof(struct staged_sysmodule) + ((struct staged_sysmodule *)pos)->size) {
+        if (((struct staged_sysmodule *)pos)->cake == index) return 1;
+    }
+
+    // And once it's laid out again, what it patched in there isn't where it was in the original anymore.
+    for (unsigned int x = 0; x < journal->range_count; x++) {
+        const unsigned int firm_type = journal->range[x].firm_type;
+        if (!sysmodules_rebuilt[firm_type]) continue;
+
+        const firm_section_h *sections[] = {&firms[firm_type]->section[0], &firms_orig[firm_type]->section[0]};
+        for (unsigned int y = 0; y < 2; y++) {
+            if (journal->range[x].start < sections[y]->offset + sections[y]->size &&
+                    journal->range[x].end > sections[y]->offset) {
+                return 1;
+            }
+        }
+    }
+
+    // Restoring the original bytes would break any other cake that patched the same spot.
+    for (unsigned int x = 0; x < cake_count; x++) {
+        if (x == index || !cake_journal[x].applied) continue;
+
+        for (unsigned int y = 0; y < journal->range_count; y++) {
+            for (unsigned int z = 0; z < cake_journal[x].range_count; z++) {
+                if (journal->range[y].firm_type == cake_journal[x].range[z].firm_type &&
+                        journal->range[y].start < cake_journal[x].range[z].end &&
+                        journal->range[y].end > cake_journal[x].range[z].start) {
+                    return 1;
+                }
+            }
+        }
+    }
+
+    for (unsigned int x = 0; x < journal->range_count; x++) {
+        memcpy((void *)firms[journal->range[x].firm_type] + journal->range[x].start,
+               (void *)firms_orig[journal->range[x].firm_type] + journal->range[x].start,
+               journal->range[x].end - journal->range[x].start);
+    }
+
+    // Give back the memory it allocated.
+    for (struct memory_header *memory = (void *)memory_loc + journal->memory_start;
+            (uintptr_t)memory < (uintptr_t)memory_loc + journal->memory_end;
+            memory = (void *)((uintptr_t)(memory + 1) + memory->size)) {
+        release_memory(memory->location, memory->size);
+    }
+    *memory_loc = journal->memory_start;
+    current_memory_loc = (void *)memory_loc + journal->memory_start;
+
+    // And the sysmodules it brought, rebuild_sysmodules() lays out the rest again.
+    void *dest = sysmodule_stage;
+    for (void *pos = sysmodule_stage; pos < (void *)sysmodule_stage + sysmodule_stage_size; ) {
+        struct staged_sysmodule *staged = pos;
+        uint32_t size = sizeof(*staged) + staged->size;
+        if (staged->cake != index) {
+            if (dest != pos) memmove(dest, pos, size);
+            dest += size;
+        }
+        pos += size;
+    }
+    sysmodule_stage_size = dest - (void *)sysmodule_stage;
+
+    journal->applied = 0;
+
+    // The FIRMs only need saving if a cake that's still applied wants it.
+    patches_save_firm = 0;
+    for (unsigned int x = 0; x < cake_count; x++) {
+        if (cake_journal[x].applied && cake_journal[x].save) patches_save_firm = 1;
+    }
+
+    return 0;
+}
+
 int patch_firm_all()
 {
+    // Figure out which FIRMs the selected cakes need, and load them if we haven't yet.
+    firms_needed = 1 << NATIVE_FIRM;
+    for (unsigned int i = 0; i < cake_count; i++) {
+        if (BITSET_GET(cake_selected, i)) {
+            firms_needed |= cake_list[i].firm_types;
+        }
+    }
+
+    load_legacy_firms(firms_needed);
+
+    // Now that we know their versions, drop the cakes that don't work with the FIRMs we ended up with.
+    firms_needed = 1 << NATIVE_FIRM;
+    for (unsigned int i = 0; i < cake_count; i++) {
+        if (!BITSET_GET(cake_selected, i)) continue;
+
+        if (!cake_applicable(cake_list[i].entry)) {
+            print("Skipping a cake that doesn't support\n  your FIRMs:");
+            print(cake_list[i].path);
+            BITSET_CLEAR(cake_selected, i);
+            continue;
+        }
+
+        firms_needed |= cake_list[i].firm_types;
+    }
+
+    // The patches of a cake follow the original layout of the sysmodule section,
+    //   so a FIRM that had its sysmodules laid out again can't have new ones added on top.
+    if (journal_valid && !patches_reapply) {
+        for (unsigned int i = 0; i < cake_count && !patches_reapply; i++) {
+            if (!BITSET_GET(cake_selected, i) || cake_journal[i].applied) continue;
+
+            for (unsigned int type = NATIVE_FIRM; type <= AGB_FIRM; type++) {
+                if ((cake_list[i].entry->inplace_firm_types & (1 << type)) && sysmodules_rebuilt[type]) {
+                    print("Sysmodules were moved, reapplying all");
+                    patches_reapply = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    // If we've patched before, try to only undo and apply the cakes that changed.
+    if (journal_valid && !patches_reapply) {
+        unsigned int i;
+
+        // Going backwards, as the last applied cakes have their memory patches at the end.
+        for (i = cake_count; i > 0; i--) {
+            if (cake_journal[i - 1].applied && !BITSET_GET(cake_selected, i - 1) && unapply_cake(i - 1) != 0) break;
+        }
+
+        if (i == 0) {
+            print("Updating patches...");
+
+            // FIRMs we loaded in the meantime still need to be copied.
+            if (current_twl_firm && !dirty_ranges[TWL_FIRM].valid) {
+                reset_firm(twl_firm_loc, twl_firm_orig_loc, twl_firm_size, &dirty_ranges[TWL_FIRM]);
+            }
+            if (current_agb_firm && !dirty_ranges[AGB_FIRM].valid) {
+                reset_firm(agb_firm_loc, agb_firm_orig_loc, agb_firm_size, &dirty_ranges[AGB_FIRM]);
+            }
+            ndma_copy_wait();
+
+            for (i = 0; i < cake_count; i++) {
+                if (BITSET_GET(cake_selected, i) && !cake_journal[i].applied) {
+                    if (apply_cake(i) != 0) return 1;
+                }
+            }
+
+            if (rebuild_sysmodules() != 0) return 1;
+            report_memory();
+            return 0;
+        }
+
+        print("Can't undo a cake, reapplying all");
+    }
+
     print("Resetting FIRM...");
     patch_reset();
 
+    memset(cake_journal, 0, sizeof(*cake_journal) * cake_count);
+    journal_valid = 1;
+    patches_reapply = 0;
+
     for (unsigned int i = 0; i < cake_count; i++) {
-        if (cake_selected[i]) {
-            if (read_file(firm_patch_temp, cake_list[i].path, FCRAM_SPACING * 2) != 0) {
-                print("Failed to load patch");
-                draw_message("Failed to load patch", "Please make sure all the patches you want\n  to apply actually exist on the SD card.");
-                return 1;
+        if (BITSET_GET(cake_selected, i)) {
+            if (apply_cake(i) != 0) return 1;
+        }
+    }
+
+    if (rebuild_sysmodules() != 0) return 1;
+    report_memory();
+    return 0;
+}
+
+// Pull what the cake list needs out of a cake's header.
+// Returns 2 and the size of the header if it's bigger than what we've read of it.
+static int parse_cake(const void *_cake, const uint32_t size, const uint32_t file_size,
+        struct catalog_entry *entry, uint32_t *needed)
+{
+    const struct cake_header *cake = _cake;
+
+    entry->firm_types = 0;
+    entry->patch_firm_types = 0;
+    entry->inplace_firm_types = 0;
+    entry->version_count = 0;
+    entry->description[0] = 0;
+
+    if (size < sizeof(*cake)) return 1;
+    if (cake->version < MIN_FORMAT_VERSION || cake->version > FORMAT_VERSION) return 1;
+    const uint32_t version_size = VERSION_SIZE(cake->version);
+
+    // Everything up to the last versions array has to be in memory.
+    uint32_t header_size = cake->patches_offset + cake->patch_count * sizeof(struct patch);
+    if (header_size <= size) {
+        struct patch *patches = (struct patch *)((uintptr_t)cake + cake->patches_offset);
+        for (struct patch *patch = patches;
+                patch < patches + cake->patch_count; patch++) {
+            uint32_t versions_end = patch->versions_offset + patch->version_count * version_size;
+            if (versions_end > header_size) header_size = versions_end;
+        }
+    }
+    if (header_size > file_size) return 1;
+    if (header_size > size) {
+        *needed = header_size;
+        return 2;
+    }
+
+    struct patch *patches = (struct patch *)((uintptr_t)cake + cake->patches_offset);
+    for (struct patch *patch = patches;
+            patch < patches + cake->patch_count; patch++) {
+        // Only patches that need a FIRM can be applied.
+        if ((patch->type != TYPE_FIRM && patch->type != TYPE_MEMORY &&
+                    patch->type != TYPE_SYSMODULE && patch->type != TYPE_DELTA) ||
+                patch->firm_type > AGB_FIRM) {
+            continue;
+        }
+
+        // Collect the FIRM types this cake needs.
+        entry->firm_types |= 1 << patch->firm_type;
+        entry->patch_firm_types |= 1 << patch->firm_type;
+        if (patch->type == TYPE_FIRM || patch->type == TYPE_DELTA) {
+            entry->inplace_firm_types |= 1 << patch->firm_type;
+        }
+
+        // The save option makes NATIVE_FIRM boot the patched copies of the other FIRMs.
+        if (patch->options & patch_option_save && patch->firm_type == NATIVE_FIRM) {
+            entry->firm_types |= 1 << TWL_FIRM | 1 << AGB_FIRM;
+        }
+
+        // Collect every FIRM version it supports, once.
+        void *versions = (void *)((uintptr_t)cake + patch->versions_offset);
+        for (unsigned int x = 0; x < patch->version_count; x++) {
+            uint32_t version = (uint32_t)patch->firm_type << 24 | VERSION_AT(versions, version_size, x)->version;
+
+            unsigned int y;
+            for (y = 0; y < entry->version_count; y++) {
+                if (entry->versions[y] == version) break;
+            }
+            if (y == entry->version_count) {
+                if ((uintptr_t)&entry->versions[y + 1] > (uintptr_t)cake_catalog_new + FCRAM_SPACING) return 1;
+                entry->versions[entry->version_count++] = version;
             }
-            if (patch_firm(firm_patch_temp, FCRAM_SPACING * 2)) return 1;
         }
     }
 
+    // Get the cake description
+    uint32_t desc_size = cake->patches_offset - sizeof(*cake);
+    if (cake->patches_offset < sizeof(*cake)) desc_size = 0;
+    if (desc_size > sizeof(entry->description) - 1) desc_size = sizeof(entry->description) - 1;
+    memcpy(entry->description, cake->description, desc_size);
+    entry->description[desc_size] = 0;
+
     return 0;
 }
 
-int load_cakes_info(const char *dirpath)
+// Look up a cake in the catalog from the last boot, if it hasn't changed since.
+static struct catalog_entry *find_catalog_entry(const char *path, const FILINFO *fno)
+{
+    if (!cake_catalog_valid) return NULL;
+
+    // Most of the time, the directory is read in the same order as last time.
+    for (unsigned int x = 0; x < cake_catalog->count; x++) {
+        if (catalog_next >= cake_catalog->count) {
+            catalog_next = 0;
+            catalog_next_entry = (struct catalog_entry *)(cake_catalog + 1);
+        }
+
+        struct catalog_entry *entry = catalog_next_entry;
+        catalog_next++;
+        catalog_next_entry = (struct catalog_entry *)((uintptr_t)entry + CATALOG_ENTRY_SIZE(entry));
+
+        if (strncmp(entry->path, path, sizeof(entry->path)) == 0) {
+            if (entry->size == fno->fsize && entry->date == fno->fdate && entry->time == fno->ftime) {
+                return entry;
+            }
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+// Keep a copy of a string for the cake list.
+static const char *add_cake_string(const char *string)
+{
+    unsigned int size = strlen(string) + 1;
+
+    if ((uintptr_t)cake_strings - size < (uintptr_t)(cake_list + cake_count + 1)) return NULL;
+
+    cake_strings -= size;
+    memcpy(cake_strings, string, size);
+    return cake_strings;
+}
+
+// Look for cakes in the directory in cake_path, which is pathlen long.
+static int load_cakes_dir(const unsigned int pathlen)
 {
     FRESULT fr;
     DIR dir;
     FILINFO fno;
     FIL handle;
 
-    const int pathlen = strlen(dirpath);
-
-    fr = f_opendir(&dir, dirpath);
+    fr = f_opendir(&dir, cake_path);
     if (fr != FR_OK) goto error;
 
-    static_assert(MAX_CAKES < 0x100000 / sizeof(struct cake_info),
-                  "This function will overflow it's buffer");
-
     while (cake_count < MAX_CAKES) {
         fr = f_readdir(&dir, &fno);
         if (fr != FR_OK) {
@@ -686,97 +1906,82 @@ int load_cakes_info(const char *dirpath)
         }
 
         // Build the path string
-        memcpy(cake_list[cake_count].path, dirpath, pathlen);
-        cake_list[cake_count].path[pathlen] = '/';
-        strncpy(&cake_list[cake_count].path[pathlen + 1], fno.fname, sizeof(cake_list->path) - pathlen - 1);
-        cake_list[cake_count].path[sizeof(cake_list->path) - 1] = 0;  // Make sure it terminates.
+        if (pathlen + 2 >= sizeof(cake_path)) continue;
+        cake_path[pathlen] = '/';
+        strncpy(&cake_path[pathlen + 1], fno.fname, sizeof(cake_path) - pathlen - 2);  // Terminates it.
 
         // Recurse into subdirectories
         if (fno.fattrib & AM_DIR) {
-            // Using the path stored in the current cake.
-            fr = load_cakes_info(cake_list[cake_count].path);
+            fr = load_cakes_dir(strlen(cake_path));
             if (fr != FR_OK) return fr;
             continue;
         }
 
         // Make sure the filename ends in .cake
-        if (!memsearch(cake_list[cake_count].path, ".cake",
-                sizeof(cake_list[cake_count].path), 6)) {
+        if (!memsearch(cake_path, ".cake", sizeof(cake_path), 6)) {
             continue;
         }
 
-        // Open the file
-        fr = f_open(&handle, cake_list[cake_count].path, FA_READ);
-        if (fr != FR_OK) goto error;
-
-        // Get the header
-        unsigned int bytes_read = 0;
-        struct cake_header header;
-        fr = f_read(&handle, &header, sizeof(header), &bytes_read);
-        if (fr != FR_OK || bytes_read != sizeof(header)) goto error;
-
-        // Get patch list
-        bytes_read = 0;
-        struct patch patches[header.patch_count];
-        fr = f_lseek(&handle, header.patches_offset);
-        if (fr != FR_OK) goto error;
-        fr = f_read(&handle, patches, sizeof(patches), &bytes_read);
-        if (fr != FR_OK || bytes_read != sizeof(patches)) goto error;
+        // Where this cake goes in the new catalog.
+        struct catalog_entry *entry = (struct catalog_entry *)((uintptr_t)cake_catalog_new + cake_catalog_new->size);
+        if ((uintptr_t)(entry + 1) > (uintptr_t)cake_catalog_new + FCRAM_SPACING) {
+            fr = FR_NOT_ENOUGH_CORE;
+            goto error;
+        }
 
-        // Check if the right FIRM version is available.
-        for (struct patch *patch = patches;
-                patch < patches + header.patch_count; patch++) {
-            // We check if the cake file has at least one patch that can be applied.
-            // If it's a patch which needs a FIRM, we check if the correct FIRM version is available.
-            if (patch->type == TYPE_FIRM || patch->type == TYPE_MEMORY || patch->type == TYPE_SYSMODULE) {
-                // Read the versions.
-                bytes_read = 0;
-                struct patch_version versions[patch->version_count];
-                fr = f_lseek(&handle, patch->versions_offset);
-                if (fr != FR_OK) goto error;
-                fr = f_read(&handle, versions, sizeof(versions), &bytes_read);
-                if (fr != FR_OK || bytes_read != sizeof(versions)) goto error;
-
-                struct firm_signature *firm_info = NULL;
-
-                switch (patch->firm_type) {
-                    case NATIVE_FIRM:
-                        firm_info = current_firm;
-                        break;
-                    case TWL_FIRM:
-                        firm_info = current_twl_firm;
-                        break;
-                    case AGB_FIRM:
-                        firm_info = current_agb_firm;
-                        break;
-                }
+        struct catalog_entry *cached = find_catalog_entry(cake_path, &fno);
+        if (cached) {
+            memcpy(entry, cached, CATALOG_ENTRY_SIZE(cached));
+        } else {
+            // Read the whole header at once, it's usually a lot smaller than this.
+            fr = f_open(&handle, cake_path, FA_READ);
+            if (fr != FR_OK) goto error;
+
+            unsigned int bytes_read = 0;
+            uint32_t size = fno.fsize < CATALOG_READ_SIZE ? fno.fsize : CATALOG_READ_SIZE;
+            fr = f_read(&handle, fcram_temp, size, &bytes_read);
+            if (fr != FR_OK || bytes_read != size) goto error;
+
+            uint32_t needed = 0;
+            int status = parse_cake(fcram_temp, size, fno.fsize, entry, &needed);
+            if (status == 2 && needed <= FCRAM_SPACING) {
+                fr = f_read(&handle, fcram_temp + size, needed - size, &bytes_read);
+                if (fr != FR_OK || bytes_read != needed - size) goto error;
+
+                status = parse_cake(fcram_temp, needed, fno.fsize, entry, &needed);
+            }
 
-                // If the FIRM isn't loaded, this patch can't be applied.
-                if (!firm_info) continue;
+            fr = f_close(&handle);
+            if (fr != FR_OK) goto error;
 
-                // If this patch doesn't have a version for the currently loaded FIRM, it can't be applied.
-                for (struct patch_version *version = versions;
-                        version < versions + patch->version_count; version++) {
-                    if (version->console == firm_info->console &&
-                            version->firm_version == firm_info->version) {
-                        goto patch_applicable;
-                    }
-                }
+            // Remember broken cakes as well, with nothing that can be applied.
+            if (status != 0) {
+                entry->firm_types = 0;
+                entry->patch_firm_types = 0;
+                entry->inplace_firm_types = 0;
+                entry->version_count = 0;
             }
+
+            strncpy(entry->path, cake_path, sizeof(entry->path) - 1);
+            entry->size = fno.fsize;
+            entry->date = fno.fdate;
+            entry->time = fno.ftime;
+            cake_catalog_dirty = 1;
         }
 
-        // This patch can't be applied.
-        continue;
-patch_applicable:;
+        cake_catalog_new->count++;
+        cake_catalog_new->size += CATALOG_ENTRY_SIZE(entry);
 
-        // Get the patch description
-        const int desc_size = header.patches_offset - sizeof(header);
-        fr = f_lseek(&handle, 3);
-        fr = f_read(&handle, cake_list[cake_count].description, desc_size, &bytes_read);
-        if (fr != FR_OK) goto error;
+        if (!cake_applicable(entry)) continue;
 
-        fr = f_close(&handle);
-        if (fr != FR_OK) goto error;
+        cake_list[cake_count].path = add_cake_string(cake_path);
+        cake_list[cake_count].description = add_cake_string(entry->description);
+        if (!cake_list[cake_count].path || !cake_list[cake_count].description) {
+            print("Too many cakes, skipping the rest");
+            break;
+        }
+        cake_list[cake_count].firm_types = entry->firm_types;
+        cake_list[cake_count].entry = entry;
 
         cake_count++;
     }
@@ -790,4 +1995,47 @@ error:
     f_closedir(&dir);
     return fr;
 }
+
+int load_cakes_info(const char *dirpath)
+{
+    // Load the catalog from the last boot, if it's one we can use.
+    cake_catalog_valid = 0;
+    if (read_file(cake_catalog, PATH_CAKE_CATALOG, FCRAM_SPACING) == 0 &&
+            cake_catalog->magic == CATALOG_MAGIC && cake_catalog->version == CATALOG_VERSION &&
+            cake_catalog->format == FORMAT_VERSION && cake_catalog->size <= FCRAM_SPACING) {
+        // Make sure all the entries are where it says they are.
+        uintptr_t end = (uintptr_t)(cake_catalog + 1);
+        for (unsigned int x = 0; x < cake_catalog->count; x++) {
+            struct catalog_entry *entry = (struct catalog_entry *)end;
+            if (end + sizeof(*entry) > (uintptr_t)cake_catalog + cake_catalog->size) break;
+            end += CATALOG_ENTRY_SIZE(entry);
+        }
+        cake_catalog_valid = end == (uintptr_t)cake_catalog + cake_catalog->size;
+    }
+    catalog_next = 0;
+    catalog_next_entry = (struct catalog_entry *)(cake_catalog + 1);
+
+    cake_catalog_new->magic = CATALOG_MAGIC;
+    cake_catalog_new->version = CATALOG_VERSION;
+    cake_catalog_new->format = FORMAT_VERSION;
+    cake_catalog_new->count = 0;
+    cake_catalog_new->size = sizeof(*cake_catalog_new);
+    cake_catalog_dirty = !cake_catalog_valid;
+
+    strncpy(cake_path, dirpath, sizeof(cake_path) - 1);
+    int fr = load_cakes_dir(strlen(cake_path));
+    if (fr != FR_OK) return fr;
+
+    // Cakes that were removed also need to go.
+    if (cake_catalog_valid && cake_catalog_new->count != cake_catalog->count) {
+        cake_catalog_dirty = 1;
+    }
+
+    if (cake_catalog_dirty) {
+        print("Saving the cake catalog");
+        write_file(cake_catalog_new, PATH_CAKE_CATALOG, cake_catalog_new->size);
+    }
+
+    return 0;
+}
 #endif
@@ -1,14 +1,21 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include "headers.h"
 #include "fatfs/ffconf.h"
+#include "bitset.h"
 
-#define MAX_CAKES 0x10
+#define MAX_CAKES 0x1000
 
+struct catalog_entry;
+
+// The strings live in the same place as the list, see load_cakes_info().
 struct cake_info {
-    char path[_MAX_LFN + 1];
-    char description[0x100];
+    const char *path;
+    const char *description;
+    unsigned int firm_types;  // Bitmask of the FIRM types this cake needs.
+    const struct catalog_entry *entry;  // Where it is in the catalog built by load_cakes_info().
 };
 
 struct memory_header {
@@ -22,9 +29,13 @@ extern firm_h *agb_firm_loc;
 
 extern struct cake_info *cake_list;
 extern unsigned int cake_count;
-int cake_selected[MAX_CAKES];
+extern uint32_t cake_selected[BITSET_SIZE(MAX_CAKES)];
+extern unsigned int firms_needed;
+extern int patches_reapply;
+extern int patches_save_firm;
 extern uint32_t *memory_loc;
 
 int get_emunand_offsets(uint32_t location, uint32_t *offset, uint32_t *header);
 int patch_firm_all();
+size_t firm_end(const firm_h *firm, size_t size);
 int load_cakes_info(const char *dirpath);
@@ -9,18 +9,24 @@
 #define PATH_PATCHED_FIRMWARE PATH_CAKES "/firmware_patched.bin"
 #define PATH_FIRMKEY PATH_CAKES "/firmkey.bin"
 #define PATH_CETK PATH_CAKES "/cetk"
+#define PATH_FIRMWARE_VERIFIED PATH_CAKES "/firmware_verified.bin"
 
 #define PATH_TWL_FIRMWARE PATH_CAKES "/twl_firmware.bin"
 #define PATH_PATCHED_TWL_FIRMWARE PATH_CAKES "/twl_firmware_patched.bin"
 #define PATH_TWL_FIRMKEY PATH_CAKES "/twl_firmkey.bin"
 #define PATH_TWL_CETK PATH_CAKES "/twl_cetk"
+#define PATH_TWL_FIRMWARE_VERIFIED PATH_CAKES "/twl_firmware_verified.bin"
 
 #define PATH_AGB_FIRMWARE PATH_CAKES "/agb_firmware.bin"
 #define PATH_PATCHED_AGB_FIRMWARE PATH_CAKES "/agb_firmware_patched.bin"
 #define PATH_AGB_FIRMKEY PATH_CAKES "/agb_firmkey.bin"
 #define PATH_AGB_CETK PATH_CAKES "/agb_cetk"
+#define PATH_AGB_FIRMWARE_VERIFIED PATH_CAKES "/agb_firmware_verified.bin"
 
 #define PATH_MEMORY PATH_CAKES "/memory.bin"
 #define PATH_UNSUPPORTED_FIRMWARE PATH_CAKES "/firmware_unsupported.bin"
 #define PATH_PATCHES PATH_CAKES "/patches"
 #define PATH_CONFIG PATH_CAKES "/config.dat"
+#define PATH_TRACE PATH_CAKES "/boot_trace.bin"
+#define PATH_PROCESS9 PATH_CAKES "/process9.bin"
+#define PATH_CAKE_CATALOG PATH_CAKES "/cake_catalog.bin"
@@ -0,0 +1,126 @@
+#ifdef STANDALONE
+
+#include "sha_soft.h"
+
+#include <stdint.h>
+#include <string.h>
+
+static const uint32_t k[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+static struct {
+    uint32_t state[8];
+    uint8_t buffer[0x40];
+    uint32_t buffered;
+    uint64_t length;
+} sha_ctx;
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha_block(const uint8_t *block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+               (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = sha_ctx.state[0], b = sha_ctx.state[1], c = sha_ctx.state[2], d = sha_ctx.state[3],
+             e = sha_ctx.state[4], f = sha_ctx.state[5], g = sha_ctx.state[6], h = sha_ctx.state[7];
+
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    sha_ctx.state[0] += a; sha_ctx.state[1] += b; sha_ctx.state[2] += c; sha_ctx.state[3] += d;
+    sha_ctx.state[4] += e; sha_ctx.state[5] += f; sha_ctx.state[6] += g; sha_ctx.state[7] += h;
+}
+
+void sha_init(__attribute__((unused)) uint32_t mode)
+{
+    static const uint32_t initial[8] = {
+        0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+    };
+
+    memcpy(sha_ctx.state, initial, sizeof(initial));
+    sha_ctx.buffered = 0;
+    sha_ctx.length = 0;
+}
+
+void sha_update(const void *src, uint32_t size)
+{
+    const uint8_t *src8 = (const uint8_t *)src;
+    sha_ctx.length += size;
+
+    if (sha_ctx.buffered) {
+        uint32_t fill = 0x40 - sha_ctx.buffered;
+        if (fill > size) fill = size;
+        memcpy(sha_ctx.buffer + sha_ctx.buffered, src8, fill);
+        sha_ctx.buffered += fill;
+        src8 += fill;
+        size -= fill;
+
+        if (sha_ctx.buffered < 0x40) return;
+        sha_block(sha_ctx.buffer);
+        sha_ctx.buffered = 0;
+    }
+
+    for (; size >= 0x40; size -= 0x40, src8 += 0x40) {
+        sha_block(src8);
+    }
+
+    memcpy(sha_ctx.buffer, src8, size);
+    sha_ctx.buffered = size;
+}
+
+void sha_final(void *res, const void *src, uint32_t size)
+{
+    sha_update(src, size);
+
+    // Pad with a single set bit, zeroes, and the length in bits.
+    uint64_t bits = sha_ctx.length * 8;
+    sha_ctx.buffer[sha_ctx.buffered++] = 0x80;
+    if (sha_ctx.buffered > 0x38) {
+        memset(sha_ctx.buffer + sha_ctx.buffered, 0, 0x40 - sha_ctx.buffered);
+        sha_block(sha_ctx.buffer);
+        sha_ctx.buffered = 0;
+    }
+    memset(sha_ctx.buffer + sha_ctx.buffered, 0, 0x38 - sha_ctx.buffered);
+    for (int i = 0; i < 8; i++) {
+        sha_ctx.buffer[0x38 + i] = bits >> (56 - i * 8);
+    }
+    sha_block(sha_ctx.buffer);
+    sha_ctx.buffered = 0;
+
+    uint8_t *res8 = (uint8_t *)res;
+    for (int i = 0; i < 8; i++) {
+        res8[i * 4] = sha_ctx.state[i] >> 24;
+        res8[i * 4 + 1] = sha_ctx.state[i] >> 16;
+        res8[i * 4 + 2] = sha_ctx.state[i] >> 8;
+        res8[i * 4 + 3] = sha_ctx.state[i];
+    }
+}
+
+void sha(void *res, const void *src, uint32_t size, uint32_t mode)
+{
+    sha_init(mode);
+    sha_final(res, src, size);
+}
+
+#endif
@@ -0,0 +1,14 @@
+#pragma once
+
+// Software stand-in for the SHA engine, for the host build.
+// Only does SHA-256, and like the engine, a single hash at a time.
+
+#include <stdint.h>
+
+#define SHA_256_MODE 0
+#define SHA_256_HASH_SIZE (256 / 8)
+
+void sha_init(uint32_t mode);
+void sha_update(const void *src, uint32_t size);
+void sha_final(void *res, const void *src, uint32_t size);
+void sha(void *res, const void *src, uint32_t size, uint32_t mode);
@@ -0,0 +1,117 @@
+#include "trace.h"
+
+#include <stdint.h>
+#include "memfuncs.h"
+#include "fs.h"
+#include "paths.h"
+
+#define REG_TIMER_VAL(n) ((volatile uint16_t *)(0x10003000 + (n) * 4))
+#define REG_TIMER_CNT(n) ((volatile uint16_t *)(0x10003002 + (n) * 4))
+
+#define TIMER_PRESCALER_64 0x01
+#define TIMER_COUNT_UP 0x04
+#define TIMER_START 0x80
+
+static struct {
+    struct trace_header header;
+    struct trace_span spans[MAX_TRACE_SPANS];
+    struct trace_counter counters[MAX_TRACE_COUNTERS];
+} trace;
+
+static unsigned int span_count = 0;
+static unsigned int depth = 0;
+
+void trace_init()
+{
+    // Timer 1 counts the overflows of timer 0, giving us a 32-bit counter.
+    *REG_TIMER_CNT(0) = 0;
+    *REG_TIMER_CNT(1) = 0;
+    *REG_TIMER_VAL(0) = 0;
+    *REG_TIMER_VAL(1) = 0;
+    *REG_TIMER_CNT(1) = TIMER_START | TIMER_COUNT_UP;
+    *REG_TIMER_CNT(0) = TIMER_START | TIMER_PRESCALER_64;
+}
+
+uint32_t trace_ticks()
+{
+    uint16_t high, low;
+
+    // Make sure timer 0 didn't overflow between reading both.
+    do {
+        high = *REG_TIMER_VAL(1);
+        low = *REG_TIMER_VAL(0);
+    } while (high != *REG_TIMER_VAL(1));
+
+    return (uint32_t)high << 16 | low;
+}
+
+unsigned int trace_begin(const char *name)
+{
+    struct trace_span *span = &trace.spans[span_count % MAX_TRACE_SPANS];
+
+    strncpy(span->name, name, sizeof(span->name) - 1);
+    span->depth = depth++;
+    span->end = 0;
+    span->start = trace_ticks();
+
+    return span_count++;
+}
+
+void trace_end(const unsigned int span)
+{
+    uint32_t ticks = trace_ticks();
+
+    if (depth) depth--;
+
+    // It may have been overwritten by newer spans already.
+    if (span_count - span > MAX_TRACE_SPANS) return;
+
+    trace.spans[span % MAX_TRACE_SPANS].end = ticks;
+}
+
+// Sets a counter to be saved along with the spans.
+void trace_count(const char *name, const uint32_t value)
+{
+    unsigned int x;
+    for (x = 0; x < trace.header.counters; x++) {
+        if (strncmp(trace.counters[x].name, name, sizeof(trace.counters[x].name) - 1) == 0) break;
+    }
+
+    if (x == trace.header.counters) {
+        if (x >= MAX_TRACE_COUNTERS) return;
+        strncpy(trace.counters[x].name, name, sizeof(trace.counters[x].name) - 1);
+        trace.header.counters++;
+    }
+
+    trace.counters[x].value = value;
+}
+
+void trace_flush()
+{
+    uint32_t ticks = trace_ticks();
+
+    // Anything still running ends here.
+    for (unsigned int x = 0; x < span_count && x < MAX_TRACE_SPANS; x++) {
+        if (!trace.spans[x].end) trace.spans[x].end = ticks;
+    }
+
+    trace.header.magic = TRACE_MAGIC;
+    trace.header.version = TRACE_VERSION;
+    trace.header.tick_rate = TRACE_TICK_RATE;
+    if (span_count > MAX_TRACE_SPANS) {
+        trace.header.count = MAX_TRACE_SPANS;
+        trace.header.first = span_count % MAX_TRACE_SPANS;
+    } else {
+        trace.header.count = span_count;
+        trace.header.first = 0;
+    }
+
+    trace.header.slots = MAX_TRACE_SPANS;
+
+    write_file(&trace, PATH_TRACE, sizeof(trace.header) + sizeof(trace.spans) +
+               sizeof(struct trace_counter) * trace.header.counters);
+
+    // Leave the timers the way we found them for whatever we're booting.
+    *REG_TIMER_CNT(0) = 0;
+    *REG_TIMER_CNT(1) = 0;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+#define MAX_TRACE_SPANS 0x40
+#define MAX_TRACE_COUNTERS 0x10
+#define TRACE_MAGIC 0x43525443  // "CTRC"
+#define TRACE_VERSION 2
+
+// The timers run at 67027964Hz, divided by 64.
+#define TRACE_TICK_RATE (67027964 / 64)
+
+// Layout of the dump, as read by boot_trace.py.
+struct trace_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t tick_rate;
+    uint32_t count;  // Amount of valid spans.
+    uint32_t first;  // Index of the oldest span, the list wraps around.
+    uint32_t slots;  // Amount of spans in the file, the counters come right after them.
+    uint32_t counters;
+};
+
+struct trace_span {
+    char name[0x10];
+    uint32_t start;
+    uint32_t end;
+    uint32_t depth;
+};
+
+struct trace_counter {
+    char name[0x10];
+    uint32_t value;
+};
+
+void trace_init();
+uint32_t trace_ticks();
+unsigned int trace_begin(const char *name);
+void trace_end(const unsigned int span);
+void trace_count(const char *name, const uint32_t value);
+void trace_flush();
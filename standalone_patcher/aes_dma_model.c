@@ -0,0 +1,140 @@
+// Runs the setup from aes_batch_dma() against the model in aes_model.h, with the real ndma_start()
+//   programming the modelled channels.
+// Checks the split between the DMA and the CPU, that the channels and the FIFO DMA sizes agree,
+//   that nothing stalls and that every block comes out right. Also makes sure the model
+//   notices when the descriptors don't agree.
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include "aes_model.h"
+#include "test.h"
+
+#define STALL_CYCLES 0x1000
+#define MAX_BLOCKS 0xFFFF
+
+// ndma.c is built against the firmware's memfuncs and cache maintenance.
+void cakes_memcpy(void *dest, const void *src, size_t size)
+{
+    memcpy(dest, src, size);
+}
+
+void cache_clean_range(const void *start, const size_t size)
+{
+    (void)start;
+    (void)size;
+}
+
+void cache_flush_range(void *start, const size_t size)
+{
+    (void)start;
+    (void)size;
+}
+
+// aes_batch_dma() with the given descriptors, ndma_wait() letting the hardware run in the meantime.
+static void run_batch(uint32_t *dst, const uint32_t *src, const uint32_t blockCount,
+                      const uint32_t aescnt, const uint32_t request_words)
+{
+    uint32_t dmaBlocks = AES_DMA_SPLIT(blockCount);
+    uint32_t dmaWords = dmaBlocks * (AES_BLOCK_SIZE / 4);
+
+    aes_model_reset();
+
+    *REG_AESBLKCNT = blockCount << 16;
+    *REG_AESCNT |= aescnt;
+
+    ndma_start(NDMA_CHANNEL_AES_OUT, REG_AESRDFIFO, dst, dmaWords, request_words, AES_DMA_OUT_FLAGS);
+    ndma_start(NDMA_CHANNEL_AES_IN, src, REG_AESWRFIFO, dmaWords, request_words, AES_DMA_IN_FLAGS);
+
+    *REG_AESCNT |= AES_CNT_START;
+
+    uint64_t last_progress = aes_model.cycles;
+    uint32_t left = dmaWords * 2;
+    while ((ndma_busy(NDMA_CHANNEL_AES_IN) || ndma_busy(NDMA_CHANNEL_AES_OUT)) && !aes_model.error) {
+        aes_model_tick(1);
+
+        uint32_t now_left = *REG_NDMA_TCNT(NDMA_CHANNEL_AES_IN) + *REG_NDMA_TCNT(NDMA_CHANNEL_AES_OUT);
+        if (now_left != left) {
+            left = now_left;
+            last_progress = aes_model.cycles;
+        } else if (aes_model.cycles - last_progress > STALL_CYCLES) {
+            aes_model_fail("NDMA channels stalled");
+        }
+    }
+
+    aes_model_fifo_cpu(dst + dmaWords, src + dmaWords, blockCount - dmaBlocks);
+}
+
+static int test_batch(uint32_t *dst, const uint32_t *src, const uint32_t blockCount)
+{
+    uint32_t dmaBlocks = AES_DMA_SPLIT(blockCount);
+
+    memset(dst, 0, blockCount * AES_BLOCK_SIZE);
+    run_batch(dst, src, blockCount, AES_DMA_CNT, AES_DMA_BLOCK_WORDS);
+
+    check(!aes_model.error, "%u blocks: %s", blockCount, aes_model.error);
+    check(dmaBlocks <= blockCount && blockCount - dmaBlocks < AES_DMA_BLOCKS,
+          "%u blocks: %u left for the CPU", blockCount, blockCount - dmaBlocks);
+    check(aes_model.dma_requests[NDMA_CHANNEL_AES_IN] == dmaBlocks / AES_DMA_BLOCKS &&
+          aes_model.dma_requests[NDMA_CHANNEL_AES_OUT] == dmaBlocks / AES_DMA_BLOCKS,
+          "%u blocks: %u and %u requests, expected %u", blockCount,
+          aes_model.dma_requests[NDMA_CHANNEL_AES_IN], aes_model.dma_requests[NDMA_CHANNEL_AES_OUT],
+          dmaBlocks / AES_DMA_BLOCKS);
+    check(!aes_model.running && !aes_model.blocks && !aes_model.wr_count && !aes_model.rd_count,
+          "%u blocks: the batch didn't finish cleanly", blockCount);
+    check(aes_model_check_output(dst, src, blockCount) == 0, "%u blocks: wrong output", blockCount);
+
+    return 0;
+
+error:
+    return 1;
+}
+
+// The model has to notice descriptors that don't agree, or the tests above prove nothing.
+static int test_mismatch(uint32_t *dst, const uint32_t *src, const uint32_t aescnt,
+                         const uint32_t request_words, const char *what)
+{
+    run_batch(dst, src, AES_DMA_MIN_BLOCKS, aescnt, request_words);
+    check(aes_model.error, "Not caught: %s", what);
+    printf("Caught %s: %s\n", what, aes_model.error);
+    return 0;
+
+error:
+    return 1;
+}
+
+int main()
+{
+    const uint32_t counts[] = {0x100, 0x3FF, 0x1001, MAX_BLOCKS};
+    const size_t size = MAX_BLOCKS * AES_BLOCK_SIZE;
+
+    _Static_assert(AES_DMA_MIN_BLOCKS >= AES_DMA_BLOCKS, "aes() would start the DMA with nothing to move");
+
+    uint8_t *fcram = aes_model_init(size * 2);
+    if (!fcram) return 1;
+    uint32_t *src = (uint32_t *)fcram;
+    uint32_t *dst = (uint32_t *)(fcram + size);
+
+    srand(1);
+    for (size_t x = 0; x < size / 4; x++) src[x] = rand() ^ (uint32_t)rand() << 16;
+
+    // aes() only uses the DMA from AES_DMA_MIN_BLOCKS on, try every remainder from there.
+    unsigned int tested = 0;
+    for (uint32_t blocks = AES_DMA_MIN_BLOCKS; blocks < AES_DMA_MIN_BLOCKS + AES_DMA_BLOCKS * 3; blocks++) {
+        if (test_batch(dst, src, blocks)) return 1;
+        tested++;
+    }
+    for (unsigned int x = 0; x < sizeof(counts) / sizeof(*counts); x++) {
+        if (test_batch(dst, src, counts[x])) return 1;
+        tested++;
+    }
+    printf("%u batches right, %.1f cycles per block on the last one\n",
+           tested, (double)aes_model.cycles / MAX_BLOCKS);
+
+    if (test_mismatch(dst, src, AES_DMA_CNT, AES_DMA_BLOCK_WORDS / 2, "channels moving half the FIFO DMA size") ||
+            test_mismatch(dst, src, 0, AES_DMA_BLOCK_WORDS, "FIFO DMA sizes left at their default")) {
+        return 1;
+    }
+
+    return 0;
+}
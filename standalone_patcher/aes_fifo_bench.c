@@ -0,0 +1,88 @@
+// Compares the cycles the CPU loops in crypto.c take to push a batch through the AES FIFOs,
+//   using the cycle-approximate model in aes_model.h: aes_fifo_cpu(), which checks REG_AESCNT
+//   before every block, and aes_batch_burst(), which moves as many blocks as fit per check.
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include "aes_model.h"
+#include "test.h"
+
+#define MAX_BLOCKS 0xFFFF
+
+// The same loop as aes_batch_burst() in crypto.c, against the model.
+static void fifo_burst(uint32_t *dst32, const uint32_t *src32, const uint32_t blockCount)
+{
+    uint32_t wbc = blockCount;
+    uint32_t rbc = blockCount;
+
+    while (rbc && !aes_model.error) {
+        aes_model_tick(AES_MODEL_LOOP_CYCLES);
+
+        uint32_t cnt = aes_model_read_cnt();
+        uint32_t wblocks = (0x10 - (cnt & 0x1F)) / 4;
+        uint32_t rblocks = ((cnt >> 5) & 0x1F) / 4;
+
+        if (wblocks > wbc) wblocks = wbc;
+        wbc -= wblocks;
+        rbc -= rblocks;
+
+        while (wblocks--) {
+            aes_model_tick(4 * AES_MODEL_BURST_CYCLES);  // ldmia
+            for (unsigned int x = 0; x < 4; x++) aes_model_write_fifo(*src32++);
+        }
+
+        while (rblocks--) {
+            for (unsigned int x = 0; x < 4; x++) *dst32++ = aes_model_read_fifo();
+            aes_model_tick(4 * AES_MODEL_BURST_CYCLES);  // stmia
+        }
+    }
+}
+
+// Runs a batch the way aes_batch() and aes_batch_burst() start it, returns the cycles it took.
+static uint64_t run_batch(void (*loop)(uint32_t *, const uint32_t *, const uint32_t),
+                          uint32_t *dst, const uint32_t *src, const uint32_t blockCount)
+{
+    aes_model_reset();
+    *REG_AESBLKCNT = blockCount << 16;
+    *REG_AESCNT |= AES_CNT_START;
+
+    loop(dst, src, blockCount);
+    return aes_model.cycles;
+}
+
+int main()
+{
+    const uint32_t counts[] = {AES_BURST_MIN_BLOCKS, 0x40, 0x400, MAX_BLOCKS};
+    const size_t size = MAX_BLOCKS * AES_BLOCK_SIZE;
+
+    uint8_t *fcram = aes_model_init(size * 2);
+    if (!fcram) return 1;
+    uint32_t *src = (uint32_t *)fcram;
+    uint32_t *dst = (uint32_t *)(fcram + size);
+
+    srand(1);
+    for (size_t x = 0; x < size / 4; x++) src[x] = rand() ^ (uint32_t)rand() << 16;
+
+    printf("Engine takes %u cycles per block\n", AES_MODEL_BLOCK_CYCLES);
+    for (unsigned int x = 0; x < sizeof(counts) / sizeof(*counts); x++) {
+        uint32_t blocks = counts[x];
+
+        uint64_t cpu = run_batch(aes_model_fifo_cpu, dst, src, blocks);
+        check(!aes_model.error, "aes_fifo_cpu, %u blocks: %s", blocks, aes_model.error);
+        check(aes_model_check_output(dst, src, blocks) == 0, "aes_fifo_cpu, %u blocks: wrong output", blocks);
+
+        memset(dst, 0, blocks * AES_BLOCK_SIZE);
+        uint64_t burst = run_batch(fifo_burst, dst, src, blocks);
+        check(!aes_model.error, "aes_batch_burst, %u blocks: %s", blocks, aes_model.error);
+        check(aes_model_check_output(dst, src, blocks) == 0, "aes_batch_burst, %u blocks: wrong output", blocks);
+
+        printf("%6u blocks: aes_fifo_cpu %.1f, aes_batch_burst %.1f cycles per block (%.2fx)\n", blocks,
+               (double)cpu / blocks, (double)burst / blocks, (double)cpu / burst);
+    }
+
+    return 0;
+
+error:
+    return 1;
+}
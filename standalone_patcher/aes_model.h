@@ -0,0 +1,285 @@
+// Register-level host model of the AES engine's FIFOs and the NDMA channels, including the ones feeding them.
+// The registers are mapped at their real addresses, so the firmware's own register macros and
+//   ndma_start() work unchanged. Everything with a side effect, like a FIFO access, goes through
+//   the functions here instead, and aes_model_tick() lets the hardware catch up.
+// Time is counted in ARM9 cycles. The costs are rough, they only have to be in the right proportion.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "external/crypto.h"
+#include "ndma.h"
+
+#define AES_MODEL_FIFO_WORDS 16
+
+#define AES_MODEL_IO_CYCLES 4  // A CPU access to an AES register
+#define AES_MODEL_MEM_CYCLES 2  // A CPU load or store of a single word
+#define AES_MODEL_BURST_CYCLES 1  // Every word of an ldm or stm
+#define AES_MODEL_LOOP_CYCLES 3  // Compare and branch
+#define AES_MODEL_BLOCK_CYCLES 16  // The engine working on a block
+#define AES_MODEL_DMA_CYCLES 2  // NDMA moving a word
+
+// Where the register pages and the buffers the NDMA engine can reach live.
+#define AES_MODEL_IO_BASE 0x10000000
+#define AES_MODEL_IO_SIZE 0x10000
+#define AES_MODEL_FCRAM_BASE 0x20000000
+
+#define NDMA_MODEL_CHANNELS 8
+#define NDMA_STARTUP(cnt) (((cnt) >> 24) & 0xF)
+#define NDMA_SRC_UPDATE(cnt) ((cnt) & (3 << 13))
+#define NDMA_DST_UPDATE(cnt) ((cnt) & (3 << 10))
+
+struct aes_model {
+    uint32_t wrfifo[AES_MODEL_FIFO_WORDS];
+    unsigned int wr_count;
+    uint32_t rdfifo[AES_MODEL_FIFO_WORDS];
+    unsigned int rd_count;
+    int running;
+    uint32_t blocks;  // Left in the batch
+    uint32_t block_index;  // For the stand-in cipher
+    uint64_t cycles;
+    uint64_t engine_ready;  // When the engine can take the next block
+    uint64_t dma_ready;
+    uint32_t dma_requests[NDMA_MODEL_CHANNELS];
+    const char *error;
+};
+
+static struct aes_model aes_model;
+
+static inline void aes_model_fail(const char *error)
+{
+    if (!aes_model.error) aes_model.error = error;
+}
+
+// Maps the register pages and size bytes of FCRAM, returns the latter.
+static inline void *aes_model_init(size_t size)
+{
+    void *io = mmap((void *)AES_MODEL_IO_BASE, AES_MODEL_IO_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    void *fcram = mmap((void *)AES_MODEL_FCRAM_BASE, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (io != (void *)AES_MODEL_IO_BASE || fcram != (void *)AES_MODEL_FCRAM_BASE) {
+        fprintf(stderr, "Couldn't map the registers and FCRAM at their real addresses\n");
+        return NULL;
+    }
+    return fcram;
+}
+
+static inline void aes_model_reset()
+{
+    memset(&aes_model, 0, sizeof(aes_model));
+    memset((void *)AES_MODEL_IO_BASE, 0, AES_MODEL_IO_SIZE);
+}
+
+// Stands in for the cipher, it only has to make every word of every block different.
+static inline uint32_t aes_model_cipher(const uint32_t word, const uint32_t block, const unsigned int index)
+{
+    return word ^ (0x9E3779B9u * (block * 4 + index + 1));
+}
+
+// The FIFO DMA request sizes, as aes_batch_dma() encodes them in REG_AESCNT.
+static inline unsigned int aes_model_wrfifo_dma_words()
+{
+    return (((*REG_AESCNT >> 12) & 3) + 1) * 4;
+}
+
+static inline unsigned int aes_model_rdfifo_dma_words()
+{
+    return (((*REG_AESCNT >> 14) & 3) + 1) * 4;
+}
+
+static inline void aes_model_engine()
+{
+    if (!(*REG_AESCNT & AES_CNT_START)) return;
+
+    // A new batch, started by writing the registers like the firmware does.
+    if (!aes_model.running) {
+        aes_model.running = 1;
+        aes_model.blocks = *REG_AESBLKCNT >> 16;
+        aes_model.block_index = 0;
+        aes_model.engine_ready = aes_model.cycles;
+    }
+
+    // It doesn't bank the time it spent waiting on the FIFOs.
+    if (aes_model.engine_ready + AES_MODEL_BLOCK_CYCLES < aes_model.cycles) {
+        aes_model.engine_ready = aes_model.cycles - AES_MODEL_BLOCK_CYCLES;
+    }
+
+    while (aes_model.blocks && aes_model.wr_count >= 4 && aes_model.rd_count <= AES_MODEL_FIFO_WORDS - 4 &&
+            aes_model.engine_ready + AES_MODEL_BLOCK_CYCLES <= aes_model.cycles) {
+        for (unsigned int x = 0; x < 4; x++) {
+            aes_model.rdfifo[aes_model.rd_count++] = aes_model_cipher(aes_model.wrfifo[x], aes_model.block_index, x);
+        }
+        aes_model.wr_count -= 4;
+        memmove(aes_model.wrfifo, aes_model.wrfifo + 4, aes_model.wr_count * 4);
+
+        aes_model.block_index++;
+        aes_model.engine_ready += AES_MODEL_BLOCK_CYCLES;
+        if (--aes_model.blocks == 0) {
+            *REG_AESCNT &= ~AES_CNT_START;
+            aes_model.running = 0;
+        }
+    }
+}
+
+// Does whatever a channel wants to do right now, returns 1 if it moved anything.
+static inline int aes_model_channel(const unsigned int channel)
+{
+    uint32_t cnt = *REG_NDMA_CNT(channel);
+    if (!(cnt & NDMA_ENABLE)) return 0;
+    if (!(*REG_NDMA_GCNT & NDMA_GCNT_ENABLE)) {
+        aes_model_fail("NDMA channel enabled without the engine");
+        return 0;
+    }
+
+    uint32_t words = *REG_NDMA_WCNT(channel);
+    uint32_t left = *REG_NDMA_TCNT(channel);
+    if (words == 0 || left % words != 0) {
+        aes_model_fail("NDMA total isn't a multiple of the words per request");
+        return 0;
+    }
+
+    // Nothing happens until the AES engine asks for it.
+    if (NDMA_STARTUP(cnt) == NDMA_STARTUP(NDMA_STARTUP_AES_IN)) {
+        if (*REG_NDMA_DAD(channel) != (uintptr_t)REG_AESWRFIFO || NDMA_DST_UPDATE(cnt) != NDMA_DST_UPDATE_FIXED) {
+            aes_model_fail("AES input channel doesn't write to the fixed write FIFO");
+            return 0;
+        }
+        if (words != aes_model_wrfifo_dma_words()) {
+            aes_model_fail("AES input channel words don't match the write FIFO DMA size");
+            return 0;
+        }
+        if (!(*REG_AESCNT & AES_CNT_START) || AES_MODEL_FIFO_WORDS - aes_model.wr_count < words) return 0;
+    } else if (NDMA_STARTUP(cnt) == NDMA_STARTUP(NDMA_STARTUP_AES_OUT)) {
+        if (*REG_NDMA_SAD(channel) != (uintptr_t)REG_AESRDFIFO || NDMA_SRC_UPDATE(cnt) != NDMA_SRC_UPDATE_FIXED) {
+            aes_model_fail("AES output channel doesn't read from the fixed read FIFO");
+            return 0;
+        }
+        if (words != aes_model_rdfifo_dma_words()) {
+            aes_model_fail("AES output channel words don't match the read FIFO DMA size");
+            return 0;
+        }
+        if (aes_model.rd_count < words) return 0;
+    } else if (!(cnt & NDMA_IMMEDIATE)) {
+        aes_model_fail("NDMA channel with a startup mode the model doesn't know");
+        return 0;
+    }
+
+    uint32_t src = *REG_NDMA_SAD(channel);
+    uint32_t dest = *REG_NDMA_DAD(channel);
+    for (uint32_t x = 0; x < words; x++) {
+        uint32_t word;
+        if (src == (uintptr_t)REG_AESRDFIFO) {
+            word = aes_model.rdfifo[0];
+            memmove(aes_model.rdfifo, aes_model.rdfifo + 1, --aes_model.rd_count * 4);
+        } else {
+            word = *(uint32_t *)(uintptr_t)src;
+        }
+
+        if (dest == (uintptr_t)REG_AESWRFIFO) {
+            aes_model.wrfifo[aes_model.wr_count++] = word;
+        } else {
+            *(uint32_t *)(uintptr_t)dest = word;
+        }
+
+        if (NDMA_SRC_UPDATE(cnt) == NDMA_SRC_UPDATE_INC) src += 4;
+        if (NDMA_DST_UPDATE(cnt) == NDMA_DST_UPDATE_INC) dest += 4;
+    }
+    *REG_NDMA_SAD(channel) = src;
+    *REG_NDMA_DAD(channel) = dest;
+    *REG_NDMA_TCNT(channel) = left - words;
+    if (left == words) *REG_NDMA_CNT(channel) = cnt & ~NDMA_ENABLE;
+
+    aes_model.dma_requests[channel]++;
+    aes_model.dma_ready = aes_model.cycles + words * AES_MODEL_DMA_CYCLES;
+    return 1;
+}
+
+// Lets the hardware run for a while.
+static inline void aes_model_tick(const unsigned int cycles)
+{
+    uint64_t end = aes_model.cycles + cycles;
+
+    while (aes_model.cycles < end) {
+        aes_model.cycles++;
+        aes_model_engine();
+
+        // One channel transfer at a time, the engine and the channels share the bus.
+        if (aes_model.dma_ready <= aes_model.cycles) {
+            for (unsigned int x = 0; x < NDMA_MODEL_CHANNELS; x++) {
+                if (aes_model_channel(x)) break;
+            }
+        }
+    }
+}
+
+// What the CPU sees reading REG_AESCNT.
+static inline uint32_t aes_model_read_cnt()
+{
+    aes_model_tick(AES_MODEL_IO_CYCLES);
+    return (*REG_AESCNT & ~0x3FF) | aes_model.wr_count | aes_model.rd_count << 5;
+}
+
+static inline void aes_model_write_fifo(const uint32_t word)
+{
+    aes_model_tick(AES_MODEL_IO_CYCLES);
+    if (aes_model.wr_count == AES_MODEL_FIFO_WORDS) {
+        aes_model_fail("CPU overflowed the write FIFO");
+        return;
+    }
+    aes_model.wrfifo[aes_model.wr_count++] = word;
+}
+
+static inline uint32_t aes_model_read_fifo()
+{
+    aes_model_tick(AES_MODEL_IO_CYCLES);
+    if (aes_model.rd_count == 0) {
+        aes_model_fail("CPU read from an empty read FIFO");
+        return 0;
+    }
+    uint32_t word = aes_model.rdfifo[0];
+    memmove(aes_model.rdfifo, aes_model.rdfifo + 1, --aes_model.rd_count * 4);
+    return word;
+}
+
+// The same loop as aes_fifo_cpu() in crypto.c, against the model.
+static inline void aes_model_fifo_cpu(uint32_t *dst32, const uint32_t *src32, const uint32_t blockCount)
+{
+    uint32_t wbc = blockCount;
+    uint32_t rbc = blockCount;
+
+    while (rbc && !aes_model.error) {
+        aes_model_tick(AES_MODEL_LOOP_CYCLES);
+
+        if (wbc && ((aes_model_read_cnt() & 0x1F) <= 0xC)) {
+            for (unsigned int x = 0; x < 4; x++) {
+                aes_model_tick(AES_MODEL_MEM_CYCLES);
+                aes_model_write_fifo(*src32++);
+            }
+            wbc--;
+        }
+
+        if (rbc && ((aes_model_read_cnt() & (0x1F << 0x5)) >= (0x4 << 0x5))) {
+            for (unsigned int x = 0; x < 4; x++) {
+                *dst32++ = aes_model_read_fifo();
+                aes_model_tick(AES_MODEL_MEM_CYCLES);
+            }
+            rbc--;
+        }
+    }
+}
+
+// What the output of a batch should be.
+static inline int aes_model_check_output(const uint32_t *dst, const uint32_t *src, const uint32_t blockCount)
+{
+    for (uint32_t block = 0; block < blockCount; block++) {
+        for (unsigned int x = 0; x < 4; x++) {
+            if (dst[block * 4 + x] != aes_model_cipher(src[block * 4 + x], block, x)) return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+// Compares the bytes a compressed patch saves reading from the SD card with the time it takes to decompress.
+// Compress the payloads with patches/blz.py first, e.g. the sysmodules you'd put in a cake.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "blz.h"
+#include "test.h"
+
+#define ROUNDS 0x20
+
+static double now()
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char *argv[])
+{
+    int rc = 0;
+    uint8_t *compressed = NULL;
+    uint8_t *buffer = NULL;
+    FILE *fp = NULL;
+
+    check(argc > 1, "Usage: %s <compressed file>...", argv[0]);
+
+    uint64_t total_saved = 0;
+    double total_time = 0;
+
+    for (int x = 1; x < argc; x++) {
+        fp = fopen(argv[x], "rb");
+        check(fp, "Failed to open: %s", argv[x]);
+        check(fseek(fp, 0, SEEK_END) == 0, "Failed to read: %s", argv[x]);
+        long size = ftell(fp);
+        check(size >= 8 && fseek(fp, 0, SEEK_SET) == 0, "Failed to read: %s", argv[x]);
+
+        compressed = malloc(size);
+        check(compressed, "Failed to allocate memory");
+        check(fread(compressed, size, 1, fp) == 1, "Failed to read: %s", argv[x]);
+        fclose(fp);
+        fp = NULL;
+
+        uint32_t extra;
+        memcpy(&extra, compressed + size - 4, sizeof(extra));
+        uint32_t decompressed_size = size + extra;
+
+        buffer = malloc(decompressed_size);
+        check(buffer, "Failed to allocate memory");
+
+        // Like the patcher, copy it to where it goes and decompress it there.
+        double start = now();
+        for (int round = 0; round < ROUNDS; round++) {
+            memcpy(buffer, compressed, size);
+            check(blz_decompress(buffer, size, decompressed_size) == 0, "Failed to decompress: %s", argv[x]);
+        }
+        double time = (now() - start) / ROUNDS;
+
+        printf("%s: read 0x%lX instead of 0x%X bytes (%.1f%% saved), decompressed in %.3f ms (%.1f MB/s)\n",
+                argv[x], size, decompressed_size, 100.0 * extra / decompressed_size,
+                time * 1e3, decompressed_size / time / 1e6);
+
+        total_saved += extra;
+        total_time += time;
+
+        free(compressed);
+        compressed = NULL;
+        free(buffer);
+        buffer = NULL;
+    }
+
+    // Decompressing pays off as long as the SD card reads slower than this.
+    printf("Total: 0x%llX bytes saved, decompressed in %.3f ms, break-even at %.1f MB/s read speed\n",
+            (unsigned long long)total_saved, total_time * 1e3, total_saved / total_time / 1e6);
+
+    goto cleanup;
+
+error:
+    rc = 1;
+
+cleanup:
+    if (fp) fclose(fp);
+    if (compressed) free(compressed);
+    if (buffer) free(buffer);
+
+    return rc;
+}
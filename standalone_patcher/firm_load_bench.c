@@ -0,0 +1,289 @@
+// Models the chunked FIRM load in read_firm with a throttled file read standing in for the SD card,
+//   and a software AES-128-CTR standing in for the AES engine.
+// Compares reading everything before decrypting, the interleaved loop read_firm uses,
+//   and a double-buffered pipeline where the next chunk is read while the current one is decrypted,
+//   which is what it would take DMA-driven SD and AES transfers to get on the console.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "test.h"
+
+// Same as in firm.c
+#define FIRM_CHUNK_SIZE 0x40000
+
+static double sd_speed = 10;   // MB/s
+static double aes_speed = 20;  // MB/s
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Waits until a transfer of size bytes at speed MB/s started at start would have finished.
+static void throttle(double start, size_t size, double speed)
+{
+    double end = start + size / (speed * 1024 * 1024);
+    double left;
+    while ((left = end - now()) > 0) {
+        struct timespec ts = {(time_t)left, (long)((left - (time_t)left) * 1e9)};
+        nanosleep(&ts, NULL);
+    }
+}
+
+static const uint8_t sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+static uint8_t round_keys[11][16];
+
+static uint8_t xtime(uint8_t x)
+{
+    return (x << 1) ^ (x & 0x80 ? 0x1b : 0);
+}
+
+static void aes_set_key(const uint8_t key[16])
+{
+    uint8_t rcon = 1;
+
+    memcpy(round_keys[0], key, 16);
+    for (int r = 1; r < 11; r++) {
+        const uint8_t *prev = round_keys[r - 1];
+        uint8_t *cur = round_keys[r];
+
+        cur[0] = prev[0] ^ sbox[prev[13]] ^ rcon;
+        cur[1] = prev[1] ^ sbox[prev[14]];
+        cur[2] = prev[2] ^ sbox[prev[15]];
+        cur[3] = prev[3] ^ sbox[prev[12]];
+        for (int x = 4; x < 16; x++) cur[x] = prev[x] ^ cur[x - 4];
+        rcon = xtime(rcon);
+    }
+}
+
+static void aes_encrypt_block(uint8_t out[16], const uint8_t in[16])
+{
+    uint8_t s[16], t[16];
+
+    for (int x = 0; x < 16; x++) s[x] = in[x] ^ round_keys[0][x];
+    for (int r = 1; r < 11; r++) {
+        // SubBytes + ShiftRows
+        for (int c = 0; c < 4; c++) {
+            for (int row = 0; row < 4; row++) {
+                t[c * 4 + row] = sbox[s[((c + row) % 4) * 4 + row]];
+            }
+        }
+        // MixColumns
+        if (r != 10) {
+            for (int c = 0; c < 4; c++) {
+                uint8_t *col = t + c * 4;
+                uint8_t all = col[0] ^ col[1] ^ col[2] ^ col[3];
+                uint8_t first = col[0];
+                col[0] ^= all ^ xtime(col[0] ^ col[1]);
+                col[1] ^= all ^ xtime(col[1] ^ col[2]);
+                col[2] ^= all ^ xtime(col[2] ^ col[3]);
+                col[3] ^= all ^ xtime(col[3] ^ first);
+            }
+        }
+        for (int x = 0; x < 16; x++) s[x] = t[x] ^ round_keys[r][x];
+    }
+    memcpy(out, s, 16);
+}
+
+// Decrypts a chunk in CTR mode, counting blocks from the start of the file like decrypt_firm_chunk.
+static void decrypt_chunk(uint8_t *data, size_t offset, size_t size)
+{
+    double start = now();
+
+    for (size_t x = 0; x < size; x += 16) {
+        uint8_t ctr[16] = {0}, pad[16];
+        uint64_t block = (offset + x) / 16;
+        for (int y = 0; y < 8; y++) ctr[15 - y] = block >> (y * 8);
+        aes_encrypt_block(pad, ctr);
+        for (size_t y = 0; y < 16 && x + y < size; y++) data[x + y] ^= pad[y];
+    }
+
+    throttle(start, size, aes_speed);
+}
+
+static FILE *input;
+
+static int read_chunk(uint8_t *dest, size_t offset, size_t size)
+{
+    double start = now();
+    if (fseek(input, offset, SEEK_SET) != 0 || fread(dest, 1, size, input) != size) return 1;
+    throttle(start, size, sd_speed);
+    return 0;
+}
+
+static uint8_t *buffer;
+static size_t total;
+
+static int load_serial()
+{
+    if (read_chunk(buffer, 0, total)) return 1;
+    for (size_t offset = 0; offset < total; offset += FIRM_CHUNK_SIZE) {
+        size_t chunk = total - offset < FIRM_CHUNK_SIZE ? total - offset : FIRM_CHUNK_SIZE;
+        decrypt_chunk(buffer + offset, offset, chunk);
+    }
+    return 0;
+}
+
+static int load_interleaved()
+{
+    for (size_t offset = 0; offset < total; offset += FIRM_CHUNK_SIZE) {
+        size_t chunk = total - offset < FIRM_CHUNK_SIZE ? total - offset : FIRM_CHUNK_SIZE;
+        if (read_chunk(buffer + offset, offset, chunk)) return 1;
+        decrypt_chunk(buffer + offset, offset, chunk);
+    }
+    return 0;
+}
+
+// The reader runs ahead of the decryption by at most one chunk, as with two DMA buffers.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static size_t chunks_read;
+static size_t chunks_decrypted;
+static int read_failed;
+
+static void *reader(void *arg)
+{
+    (void)arg;
+
+    for (size_t offset = 0, x = 0; offset < total; offset += FIRM_CHUNK_SIZE, x++) {
+        size_t chunk = total - offset < FIRM_CHUNK_SIZE ? total - offset : FIRM_CHUNK_SIZE;
+
+        pthread_mutex_lock(&lock);
+        while (x > chunks_decrypted + 1) pthread_cond_wait(&cond, &lock);
+        pthread_mutex_unlock(&lock);
+
+        int fail = read_chunk(buffer + offset, offset, chunk);
+
+        pthread_mutex_lock(&lock);
+        if (fail) read_failed = 1;
+        else chunks_read++;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&lock);
+        if (fail) break;
+    }
+    return NULL;
+}
+
+static int load_pipelined()
+{
+    pthread_t thread;
+
+    chunks_read = 0;
+    chunks_decrypted = 0;
+    read_failed = 0;
+    if (pthread_create(&thread, NULL, reader, NULL) != 0) return 1;
+
+    for (size_t offset = 0, x = 0; offset < total; offset += FIRM_CHUNK_SIZE, x++) {
+        size_t chunk = total - offset < FIRM_CHUNK_SIZE ? total - offset : FIRM_CHUNK_SIZE;
+
+        pthread_mutex_lock(&lock);
+        while (chunks_read <= x && !read_failed) pthread_cond_wait(&cond, &lock);
+        int fail = read_failed;
+        pthread_mutex_unlock(&lock);
+        if (fail) break;
+
+        decrypt_chunk(buffer + offset, offset, chunk);
+
+        pthread_mutex_lock(&lock);
+        chunks_decrypted++;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&lock);
+    }
+
+    pthread_join(thread, NULL);
+    return read_failed;
+}
+
+static uint32_t checksum()
+{
+    uint32_t sum = 0;
+    for (size_t x = 0; x < total; x++) sum = sum * 31 + buffer[x];
+    return sum;
+}
+
+int main(int argc, char *argv[])
+{
+    int rc = 0;
+
+    static const struct {
+        const char *name;
+        int (*load)();
+    } schedules[] = {
+        {"read, then decrypt", load_serial},
+        {"interleaved (read_firm)", load_interleaved},
+        {"double-buffered", load_pipelined}
+    };
+
+    check(argc > 1, "Usage: %s <firmware file> [SD MB/s] [AES MB/s]", argv[0]);
+    if (argc > 2) sd_speed = atof(argv[2]);
+    if (argc > 3) aes_speed = atof(argv[3]);
+    check(sd_speed > 0 && aes_speed > 0, "Invalid speed");
+
+    input = fopen(argv[1], "rb");
+    check(input, "Failed to open: %s", argv[1]);
+    check(fseek(input, 0, SEEK_END) == 0, "Failed to read: %s", argv[1]);
+    total = ftell(input);
+    check(total > 0, "Empty file: %s", argv[1]);
+
+    buffer = malloc(total);
+    check(buffer, "Failed to allocate memory");
+
+    static const uint8_t key[16] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+                                    0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+    aes_set_key(key);
+
+    double io = total / (sd_speed * 1024 * 1024);
+    double crypto = total / (aes_speed * 1024 * 1024);
+    printf("%zu bytes, %zu chunks; SD alone %.3fs, AES alone %.3fs\n",
+           total, (total + FIRM_CHUNK_SIZE - 1) / FIRM_CHUNK_SIZE, io, crypto);
+
+    uint32_t expected = 0;
+    for (size_t x = 0; x < sizeof(schedules) / sizeof(*schedules); x++) {
+        memset(buffer, 0, total);
+
+        double start = now();
+        check(schedules[x].load() == 0, "Failed to read: %s", argv[1]);
+        double elapsed = now() - start;
+
+        uint32_t sum = checksum();
+        if (x == 0) expected = sum;
+        check(sum == expected, "%s: output differs", schedules[x].name);
+
+        printf("%-24s %.3fs (%.0f%% of SD + AES)\n", schedules[x].name, elapsed, elapsed * 100 / (io + crypto));
+    }
+
+exit:
+    if (input) fclose(input);
+    free(buffer);
+    return rc;
+
+error:
+    rc = 1;
+    goto exit;
+}
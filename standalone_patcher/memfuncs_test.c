@@ -0,0 +1,171 @@
+// Checks the firmware's memcpy, memmove, memset and memcmp from memfuncs.c against libc,
+//   for every combination of source and destination alignment and a range of sizes,
+//   then times them against libc. On the host they use the plain C versions of the burst loops,
+//   so only how the aligned and unaligned paths compare to each other says something about the console.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "test.h"
+
+// memfuncs.c is built with its functions renamed, so they don't clash with libc's.
+void cakes_memcpy(void *dest, const void *src, size_t size);
+void cakes_memmove(void *dest, const void *src, size_t size);
+void cakes_memset(void *dest, const int filler, size_t size);
+int cakes_memcmp(const void *buf1, const void *buf2, const size_t size);
+
+#define ALIGNMENTS 8
+#define MAX_SIZE 0x140
+#define GUARD 0x40
+#define BUFFER_SIZE (GUARD + ALIGNMENTS + MAX_SIZE + GUARD)
+
+#define BENCH_SIZE 0x100000
+#define BENCH_BYTES 0x10000000
+
+static uint8_t buffer[BUFFER_SIZE * 2];
+static uint8_t expected[BUFFER_SIZE * 2];
+
+static void fill_random(uint8_t *dest, const size_t size)
+{
+    for (size_t x = 0; x < size; x++) dest[x] = rand();
+}
+
+static int sign(const int x)
+{
+    return (x > 0) - (x < 0);
+}
+
+static double now()
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static int test_copies()
+{
+    for (size_t src_align = 0; src_align < ALIGNMENTS; src_align++) {
+        for (size_t dest_align = 0; dest_align < ALIGNMENTS; dest_align++) {
+            for (size_t size = 0; size <= MAX_SIZE; size++) {
+                uint8_t *src = buffer + GUARD + src_align;
+                uint8_t *dest = buffer + BUFFER_SIZE + GUARD + dest_align;
+
+                fill_random(buffer, sizeof(buffer));
+                memcpy(expected, buffer, sizeof(buffer));
+                memcpy(expected + (dest - buffer), src, size);
+                cakes_memcpy(dest, src, size);
+                check(memcmp(buffer, expected, sizeof(buffer)) == 0,
+                      "memcpy: %zu bytes from +%zu to +%zu", size, src_align, dest_align);
+
+                int filler = rand() & 0xFF;
+                memset(expected + (dest - buffer), filler, size);
+                cakes_memset(dest, filler, size);
+                check(memcmp(buffer, expected, sizeof(buffer)) == 0,
+                      "memset: %zu bytes at +%zu", size, dest_align);
+            }
+        }
+    }
+    return 0;
+
+error:
+    return 1;
+}
+
+// Overlapping moves, both ways, within a single buffer.
+static int test_moves()
+{
+    for (size_t src_offset = 0; src_offset < ALIGNMENTS * 2; src_offset++) {
+        for (size_t dest_offset = 0; dest_offset < ALIGNMENTS * 2; dest_offset++) {
+            for (size_t size = 0; size <= MAX_SIZE; size++) {
+                uint8_t *src = buffer + GUARD + src_offset;
+                uint8_t *dest = buffer + GUARD + dest_offset;
+
+                fill_random(buffer, sizeof(buffer));
+                memcpy(expected, buffer, sizeof(buffer));
+                memmove(expected + (dest - buffer), expected + (src - buffer), size);
+                cakes_memmove(dest, src, size);
+                check(memcmp(buffer, expected, sizeof(buffer)) == 0,
+                      "memmove: %zu bytes from +%zu to +%zu", size, src_offset, dest_offset);
+            }
+        }
+    }
+    return 0;
+
+error:
+    return 1;
+}
+
+static int test_compares()
+{
+    for (size_t align1 = 0; align1 < ALIGNMENTS; align1++) {
+        for (size_t align2 = 0; align2 < ALIGNMENTS; align2++) {
+            for (size_t size = 0; size <= MAX_SIZE; size++) {
+                uint8_t *buf1 = buffer + GUARD + align1;
+                uint8_t *buf2 = buffer + BUFFER_SIZE + GUARD + align2;
+
+                fill_random(buf1, size);
+                memcpy(buf2, buf1, size);
+                check(cakes_memcmp(buf1, buf2, size) == 0, "memcmp: %zu equal bytes at +%zu and +%zu",
+                      size, align1, align2);
+                if (!size) continue;
+
+                // Bytes compare unsigned, so make sure some of them have the top bit set.
+                size_t diff = rand() % size;
+                buf2[diff] = rand();
+                if (rand() & 1) buf2[diff] |= 0x80;
+                if (diff + 1 < size) buf2[diff + 1 + rand() % (size - diff - 1)] ^= 0xFF;
+
+                check(sign(cakes_memcmp(buf1, buf2, size)) == sign(memcmp(buf1, buf2, size)),
+                      "memcmp: %zu bytes at +%zu and +%zu differing at %zu", size, align1, align2, diff);
+                check(cakes_memcmp(buf1, buf2, diff) == 0, "memcmp: %zu bytes at +%zu and +%zu before %zu",
+                      diff, align1, align2, diff);
+            }
+        }
+    }
+    return 0;
+
+error:
+    return 1;
+}
+
+static void bench(const char *name, void (*cakes)(void *, const void *, size_t),
+                  void *(*libc)(void *, const void *, size_t), uint8_t *dest, const uint8_t *src,
+                  const size_t size)
+{
+    unsigned int rounds = BENCH_BYTES / size;
+
+    double start = now();
+    for (unsigned int x = 0; x < rounds; x++) cakes(dest, src, size);
+    double cakes_time = now() - start;
+
+    start = now();
+    for (unsigned int x = 0; x < rounds; x++) libc(dest, src, size);
+    double libc_time = now() - start;
+
+    printf("%-9s %7zu bytes: %7.0f MB/s, libc %7.0f MB/s\n", name, size,
+           BENCH_BYTES / cakes_time / 0x100000, BENCH_BYTES / libc_time / 0x100000);
+}
+
+int main()
+{
+    srand(1);
+
+    if (test_copies() || test_moves() || test_compares()) return 1;
+    printf("memcpy, memmove, memset and memcmp match libc for every alignment up to %u bytes\n", MAX_SIZE);
+
+    uint8_t *src = malloc(BENCH_SIZE + 8);
+    uint8_t *dest = malloc(BENCH_SIZE + 8);
+    if (!src || !dest) return 1;
+    fill_random(src, BENCH_SIZE + 8);
+
+    const size_t sizes[] = {0x40, 0x1000, BENCH_SIZE};
+    for (unsigned int x = 0; x < sizeof(sizes) / sizeof(*sizes); x++) {
+        bench("memcpy", cakes_memcpy, memcpy, dest, src, sizes[x]);
+        bench("unaligned", cakes_memcpy, memcpy, dest + 1, src + 2, sizes[x]);
+        bench("memmove", cakes_memmove, memmove, dest, dest + 4, sizes[x]);
+    }
+
+    free(src);
+    free(dest);
+    return 0;
+}
@@ -0,0 +1,119 @@
+// Times looking for the markers patch_options() needs in a FIRM-sized buffer: one memsearch()
+//   per marker against a single memsearch_multi() sweep. Also times the firmware's memcmp against libc.
+// Uses the given file, or random data with the markers near the start, which is the worst case
+//   for searching backwards. Both searches have to agree on where everything is.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "memsearch.h"
+#include "test.h"
+
+// memfuncs.c and memsearch.c are built against the firmware's memcmp.
+int cakes_memcmp(const void *buf1, const void *buf2, const size_t size);
+
+#define BUFFER_SIZE 0x100000
+#define ROUNDS 0x10
+
+static double now()
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char *argv[])
+{
+    int rc = 0;
+    uint8_t *buffer = NULL;
+    uint8_t *copy = NULL;
+    FILE *fp = NULL;
+    size_t size = BUFFER_SIZE;
+
+    struct search_pattern markers[] = {
+        {"NATF", 4, 0, NULL},
+        {"TWLF", 4, 0, NULL},
+        {"AGBF", 4, 0, NULL},
+        {"EMUNAND_", 8, 0, NULL},
+        {"SDMC:/cakes/", 12, 0, NULL}
+    };
+    const unsigned int count = sizeof(markers) / sizeof(*markers);
+
+    if (argc > 1) {
+        fp = fopen(argv[1], "rb");
+        check(fp, "Failed to open: %s", argv[1]);
+        check(fseek(fp, 0, SEEK_END) == 0, "Failed to read: %s", argv[1]);
+        size = ftell(fp);
+        check(size >= 4 && fseek(fp, 0, SEEK_SET) == 0, "Failed to read: %s", argv[1]);
+    }
+
+    buffer = malloc(size);
+    copy = malloc(size + 1);
+    check(buffer && copy, "Failed to allocate memory");
+
+    if (fp) {
+        check(fread(buffer, size, 1, fp) == 1, "Failed to read: %s", argv[1]);
+    } else {
+        srand(1);
+        for (size_t x = 0; x < size; x++) buffer[x] = rand();
+        for (unsigned int x = 0; x < count; x++) {
+            memcpy(buffer + 0x100 + x * 0x20, markers[x].pattern, markers[x].size);
+        }
+    }
+
+    void *found[sizeof(markers) / sizeof(*markers)];
+    double start = now();
+    for (unsigned int round = 0; round < ROUNDS; round++) {
+        for (unsigned int x = 0; x < count; x++) {
+            found[x] = memsearch(buffer, markers[x].pattern, size, markers[x].size);
+        }
+    }
+    double single_time = (now() - start) / ROUNDS;
+
+    start = now();
+    for (unsigned int round = 0; round < ROUNDS; round++) {
+        memsearch_multi(buffer, size, markers, count);
+    }
+    double multi_time = (now() - start) / ROUNDS;
+
+    for (unsigned int x = 0; x < count; x++) {
+        check(markers[x].found == found[x], "%.*s: memsearch found it at %td, memsearch_multi at %td",
+              (int)markers[x].size, (const char *)markers[x].pattern,
+              found[x] ? (uint8_t *)found[x] - buffer : -1,
+              markers[x].found ? (uint8_t *)markers[x].found - buffer : -1);
+    }
+
+    printf("%zu bytes, %u markers: memsearch %.2f ms, memsearch_multi %.2f ms (%.1fx)\n", size, count,
+           single_time * 1000, multi_time * 1000, single_time / multi_time);
+
+    // Comparing equal buffers goes all the way, like checking a hash or a section.
+    for (unsigned int offset = 0; offset < 2; offset++) {
+        memcpy(copy + offset, buffer, size);
+
+        // Otherwise the compiler only calls libc's memcmp once.
+        uint8_t *volatile compared = copy + offset;
+
+        int result = 0;
+        start = now();
+        for (unsigned int round = 0; round < ROUNDS; round++) result |= cakes_memcmp(compared, buffer, size);
+        double cakes_time = (now() - start) / ROUNDS;
+
+        start = now();
+        for (unsigned int round = 0; round < ROUNDS; round++) result |= memcmp(compared, buffer, size);
+        double libc_time = (now() - start) / ROUNDS;
+
+        check(result == 0, "memcmp found a difference in equal buffers");
+        printf("memcmp, %s: %.2f ms, libc %.2f ms\n", offset ? "unaligned" : "aligned",
+               cakes_time * 1000, libc_time * 1000);
+    }
+
+exit:
+    if (fp) fclose(fp);
+    free(buffer);
+    free(copy);
+    return rc;
+
+error:
+    rc = 1;
+    goto exit;
+}
@@ -0,0 +1,120 @@
+// Runs ndma_copy_start() from ndma.c against the NDMA channel model in aes_model.h.
+// Checks which copies go to the DMA and which stay on the CPU, that the CPU does the unaligned
+//   head and tail, that the cache maintenance covers the whole copy and that nothing around it changes.
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include "aes_model.h"
+#include "cache.h"
+#include "test.h"
+
+#define GUARD 0x40
+#define BUFFER_SIZE (NDMA_COPY_MIN_SIZE * 4)
+#define STALL_CYCLES 0x100000
+
+static uintptr_t cleaned_start, cleaned_end;
+static uintptr_t flushed_start, flushed_end;
+
+// ndma.c is built against the firmware's memfuncs and cache maintenance.
+void cakes_memcpy(void *dest, const void *src, size_t size)
+{
+    memcpy(dest, src, size);
+}
+
+void cache_clean_range(const void *start, const size_t size)
+{
+    cleaned_start = (uintptr_t)start;
+    cleaned_end = (uintptr_t)start + size;
+}
+
+void cache_flush_range(void *start, const size_t size)
+{
+    flushed_start = (uintptr_t)start;
+    flushed_end = (uintptr_t)start + size;
+}
+
+static uint8_t pattern(const size_t x)
+{
+    return x * 7 + (x >> 8);
+}
+
+// Copies size bytes from src + src_offset to dest + dest_offset, and says if the DMA did it.
+static int test_copy(uint8_t *dest, uint8_t *src, const size_t dest_offset, const size_t src_offset,
+                     const size_t size, const int expect_dma)
+{
+    for (size_t x = 0; x < BUFFER_SIZE + GUARD * 2; x++) {
+        src[x] = pattern(x);
+        dest[x] = 0xA5;
+    }
+    cleaned_start = cleaned_end = flushed_start = flushed_end = 0;
+    aes_model_reset();
+
+    uint8_t *to = dest + GUARD + dest_offset;
+    const uint8_t *from = src + GUARD + src_offset;
+    ndma_copy_start(to, from, size);
+
+    int dma = ndma_busy(NDMA_CHANNEL_COPY);
+    check(dma == expect_dma, "%zu bytes from +%zu to +%zu: expected the %s", size, src_offset, dest_offset,
+          expect_dma ? "DMA" : "CPU");
+
+    if (dma) {
+        check(cleaned_start <= (uintptr_t)from && cleaned_end >= (uintptr_t)from + size &&
+              flushed_start <= (uintptr_t)to && flushed_end >= (uintptr_t)to + size,
+              "%zu bytes from +%zu to +%zu: cache maintenance doesn't cover the copy", size, src_offset, dest_offset);
+
+        // ndma_copy_wait(), letting the hardware run in the meantime.
+        while (ndma_busy(NDMA_CHANNEL_COPY) && !aes_model.error && aes_model.cycles < STALL_CYCLES) {
+            aes_model_tick(1);
+        }
+        check(!aes_model.error, "%zu bytes from +%zu to +%zu: %s", size, src_offset, dest_offset, aes_model.error);
+        check(!ndma_busy(NDMA_CHANNEL_COPY), "%zu bytes from +%zu to +%zu: the copy stalled", size, src_offset, dest_offset);
+    }
+
+    for (size_t x = 0; x < BUFFER_SIZE + GUARD * 2; x++) {
+        uint8_t expected = 0xA5;
+        if (x >= GUARD + dest_offset && x < GUARD + dest_offset + size) {
+            expected = pattern(x - dest_offset + src_offset);
+        }
+        check(dest[x] == expected, "%zu bytes from +%zu to +%zu: wrong byte at %zd", size, src_offset, dest_offset,
+              (ssize_t)x - GUARD - (ssize_t)dest_offset);
+    }
+
+    return dma;
+
+error:
+    exit(1);
+}
+
+int main()
+{
+    const size_t sizes[] = {1, NDMA_COPY_MIN_SIZE - 1, NDMA_COPY_MIN_SIZE, NDMA_COPY_MIN_SIZE + 1,
+                            NDMA_COPY_MIN_SIZE + 3, BUFFER_SIZE - 4};
+    const size_t buffer = BUFFER_SIZE + GUARD * 2;
+
+    uint8_t *fcram = aes_model_init(buffer * 2);
+    if (!fcram) return 1;
+
+    unsigned int copies = 0, dma_copies = 0;
+    for (unsigned int x = 0; x < sizeof(sizes) / sizeof(*sizes); x++) {
+        for (size_t dest_offset = 0; dest_offset < 4; dest_offset++) {
+            for (size_t src_offset = 0; src_offset < 4; src_offset++) {
+                // Only the same alignment on both sides can be moved in words.
+                int dma = sizes[x] >= NDMA_COPY_MIN_SIZE && dest_offset == src_offset;
+                dma_copies += test_copy(fcram, fcram + buffer, dest_offset, src_offset, sizes[x], dma);
+                copies++;
+            }
+        }
+    }
+
+    // Memory the NDMA engine can't reach, like the TCMs, is copied by the CPU.
+    uint8_t *heap = malloc(buffer * 2);
+    if (!heap) return 1;
+    test_copy(heap, heap + buffer, 0, 0, BUFFER_SIZE - 4, 0);
+    test_copy(heap, fcram, 0, 0, BUFFER_SIZE - 4, 0);
+    copies += 2;
+    free(heap);
+
+    printf("%u copies right, %u of them by the DMA\n", copies, dma_copies);
+    return 0;
+}
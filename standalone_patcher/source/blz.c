@@ -0,0 +1 @@
+../../source/blz.c
\ No newline at end of file
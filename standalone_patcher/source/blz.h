@@ -0,0 +1 @@
+../../source/blz.h
\ No newline at end of file
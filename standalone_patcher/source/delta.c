@@ -0,0 +1 @@
+../../source/delta.c
\ No newline at end of file
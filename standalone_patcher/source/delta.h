@@ -0,0 +1 @@
+../../source/delta.h
\ No newline at end of file
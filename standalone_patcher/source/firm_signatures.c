@@ -1 +0,0 @@
-../../source/firm_signatures.c
\ No newline at end of file
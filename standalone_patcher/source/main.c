@@ -1,13 +1,17 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include "headers.h"
 #include "patch.h"
 #include "firm.h"
 #include "fcram.h"
+#include "sha_soft.h"
 
 #define check(condition, message, ...) if (!(condition)) { fprintf(stderr, message "\n", ##__VA_ARGS__); goto error; }
 
-void *load_file(char *path, size_t *size)
+// Allocates at least capacity bytes, so there's room for the FIRM to grow.
+void *load_file(char *path, size_t *size, size_t capacity)
 {
     if (!size) {
         size_t local_size;
@@ -25,7 +29,7 @@ void *load_file(char *path, size_t *size)
     *size = (size_t)tmp_size;
     if (fseek(fp, 0, SEEK_SET) != 0) goto error;
 
-    mem = malloc(*size);
+    mem = malloc(*size > capacity ? *size : capacity);
     if (!mem) goto error;
 
     if (fread(mem, *size, 1, fp) != 1) goto error;
@@ -49,6 +53,34 @@ int write_file(char *path, void *mem, size_t size)
     return 0;
 }
 
+// Keeps the FIRM as it was loaded, the patches that change a sysmodule or section start from that.
+firm_h *copy_firm(const firm_h *firm, size_t size)
+{
+    firm_h *copy = malloc(size);
+    if (copy) memcpy(copy, firm, size);
+    return copy;
+}
+
+// Only warns, as an ARM9 section that has been saved decrypted won't match anymore.
+void check_firm_hashes(const char *name, firm_h *firm, size_t size)
+{
+    for (int x = 0; x < 4; x++) {
+        firm_section_h *section = &firm->section[x];
+        if (!section->size) continue;
+
+        if (section->offset > size || section->size > size - section->offset) {
+            fprintf(stderr, "Warning: %s section %d is out of bounds\n", name, x);
+            continue;
+        }
+
+        uint8_t hash[SHA_256_HASH_SIZE];
+        sha(hash, (uint8_t *)firm + section->offset, section->size, SHA_256_MODE);
+        if (memcmp(hash, section->hash, SHA_256_HASH_SIZE) != 0) {
+            fprintf(stderr, "Warning: %s section %d doesn't match its hash\n", name, x);
+        }
+    }
+}
+
 int main(int argc, char *argv[])
 {
     int rc = 0;
@@ -62,43 +94,53 @@ int main(int argc, char *argv[])
 
     check(argc > 3, "Usage: %s <cake file> <memory file> <NATIVE_FIRM> [TWL_FIRM] [AGB_FIRM]", argv[0]);
 
-    cake = load_file(argv[1], &cake_size);
+    cake = load_file(argv[1], &cake_size, 0);
     check(cake, "Failed to load cake: %s", argv[1]);
 
     memory_loc = malloc(FCRAM_SPACING);
     check(memory_loc, "Failed to allocate memory");
 
-    firm_loc = load_file(argv[3], &firm_size);
+    firm_loc = load_file(argv[3], &firm_size, FCRAM_SPACING);
     check(firm_loc, "Failed to load NATIVE_FIRM: %s", argv[3]);
-    current_firm = get_firm_info(firm_loc, firm_signatures);
+    current_firm = get_firm_info(firm_loc, NATIVE_FIRM);
     check(current_firm, "Unsupported NATIVE_FIRM: %s", argv[3]);
+    check_firm_hashes("NATIVE_FIRM", firm_loc, firm_size);
+    firm_orig_loc = copy_firm(firm_loc, firm_size);
+    check(firm_orig_loc, "Failed to allocate memory");
 
     if (argc > 4) {
-        twl_firm_loc = load_file(argv[4], &twl_firm_size);
+        twl_firm_loc = load_file(argv[4], &twl_firm_size, FCRAM_SPACING * 2);
         check(twl_firm_loc, "Failed to load TWL_FIRM: %s", argv[5]);
-        current_twl_firm = get_firm_info(twl_firm_loc, twl_firm_signatures);
+        current_twl_firm = get_firm_info(twl_firm_loc, TWL_FIRM);
         check(current_twl_firm, "Unsupported TWL_FIRM: %s", argv[5]);
+        check_firm_hashes("TWL_FIRM", twl_firm_loc, twl_firm_size);
+        twl_firm_orig_loc = copy_firm(twl_firm_loc, twl_firm_size);
+        check(twl_firm_orig_loc, "Failed to allocate memory");
 
         if (argc > 5) {
-            agb_firm_loc = load_file(argv[5], &agb_firm_size);
+            agb_firm_loc = load_file(argv[5], &agb_firm_size, FCRAM_SPACING);
             check(agb_firm_loc, "Failed to load AGB_FIRM: %s", argv[5]);
-            current_agb_firm = get_firm_info(agb_firm_loc, agb_firm_signatures);
+            current_agb_firm = get_firm_info(agb_firm_loc, AGB_FIRM);
             check(current_agb_firm, "Unsupported AGB_FIRM: %s", argv[5]);
+            check_firm_hashes("AGB_FIRM", agb_firm_loc, agb_firm_size);
+            agb_firm_orig_loc = copy_firm(agb_firm_loc, agb_firm_size);
+            check(agb_firm_orig_loc, "Failed to allocate memory");
         }
     }
 
     patch_reset();
     check(patch_firm(cake, cake_size) == 0, "Failed to apply cake");
+    check(rebuild_sysmodules() == 0, "Failed to rebuild the sysmodules");
 
     check(write_file(argv[2], memory_loc, *memory_loc) == 0, "Failed to write memory file: %s", argv[2]);
 
-    check(write_file(argv[3], firm_loc, firm_size) == 0, "Failed to write NATIVE_FIRM: %s", argv[3]);
+    check(write_file(argv[3], firm_loc, firm_end(firm_loc, firm_size)) == 0, "Failed to write NATIVE_FIRM: %s", argv[3]);
 
     if (argc > 4) {
-        check(write_file(argv[4], twl_firm_loc, twl_firm_size) == 0, "Failed to write TWL_FIRM: %s", argv[4]);
+        check(write_file(argv[4], twl_firm_loc, firm_end(twl_firm_loc, twl_firm_size)) == 0, "Failed to write TWL_FIRM: %s", argv[4]);
 
         if (argc > 5) {
-            check(write_file(argv[5], agb_firm_loc, agb_firm_size) == 0, "Failed to write AGB_FIRM: %s", argv[5]);
+            check(write_file(argv[5], agb_firm_loc, firm_end(agb_firm_loc, agb_firm_size)) == 0, "Failed to write AGB_FIRM: %s", argv[5]);
         }
     }
 
@@ -113,6 +155,9 @@ cleanup:
     if (firm_loc) free(firm_loc);
     if (twl_firm_loc) free(twl_firm_loc);
     if (agb_firm_loc) free(agb_firm_loc);
+    if (firm_orig_loc) free(firm_orig_loc);
+    if (twl_firm_orig_loc) free(twl_firm_orig_loc);
+    if (agb_firm_orig_loc) free(agb_firm_orig_loc);
 
     return rc;
 }
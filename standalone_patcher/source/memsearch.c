@@ -0,0 +1 @@
+../../source/memsearch.c
\ No newline at end of file
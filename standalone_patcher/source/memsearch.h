@@ -0,0 +1 @@
+../../source/memsearch.h
\ No newline at end of file
@@ -16,3 +16,5 @@ extern firm_h *agb_firm_loc;
 
 void patch_reset();
 int patch_firm(const void *patch, size_t cake_size);
+int rebuild_sysmodules();
+size_t firm_end(const firm_h *firm, size_t size);
@@ -0,0 +1 @@
+../../source/sha_soft.c
\ No newline at end of file
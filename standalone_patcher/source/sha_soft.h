@@ -0,0 +1 @@
+../../source/sha_soft.h
\ No newline at end of file
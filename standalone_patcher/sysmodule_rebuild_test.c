@@ -0,0 +1,300 @@
+// Applies a cake that both patches and replaces sysmodules to a made-up FIRM, with the standalone patch.c.
+// Checks that rebuild_sysmodules() keeps the FIRM patches to the modules that stay, drops the ones to
+//   the module that's replaced, lays out the new modules in order and leaves the other sections alone.
+// Then rebuilds again from the result, as the firmware does when more cakes are applied later.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "headers.h"
+#include "patch.h"
+#include "firm.h"
+#include "fcram.h"
+#include "sha_soft.h"
+#include "test.h"
+
+// The standalone patcher gets these from firm.c.
+struct firm_signature *current_firm = NULL;
+struct firm_signature *current_twl_firm = NULL;
+struct firm_signature *current_agb_firm = NULL;
+firm_h *firm_orig_loc = NULL;
+firm_h *twl_firm_orig_loc = NULL;
+firm_h *agb_firm_orig_loc = NULL;
+
+// The cake format, see patches/format.txt.
+struct cake_header {
+    uint8_t version;
+    uint8_t patch_count;
+    uint8_t patches_offset;
+    char description[8];
+} __attribute__((packed));
+
+struct patch {
+    uint8_t type;
+    uint16_t firm_type;
+    uint16_t memory_id;
+    uint32_t memory_offset;
+    uint32_t offset;
+    uint32_t size;
+    uint8_t options;
+    uint8_t version_count;
+    uint32_t versions_offset;
+    uint8_t variable_count;
+    uint32_t variables_offset;
+} __attribute__((packed));
+
+struct patch_version {
+    uint16_t firm_version;
+    uint16_t console;
+    uint32_t offset;
+    uint32_t values_offset;
+    uint32_t file_offset;
+} __attribute__((packed));
+
+#define TYPE_FIRM 0
+#define TYPE_SYSMODULE 3
+
+#define FIRM_VERSION 0x1234
+#define SECTION0_OFFSET 0x200
+#define PATCH_SIZE 0x10
+#define TAIL_SIZE 0x200
+#define SECTION1_SIZE 0x400
+
+enum modules {
+    MODULE_A,  // Patched
+    MODULE_B,  // Patched, then replaced by a bigger one
+    MODULE_C,  // Patched
+    MODULE_D,  // New
+    MODULE_COUNT
+};
+
+static const uint32_t module_sizes[MODULE_COUNT] = {0x400, 0x600, 0x400, 0x400};
+static const uint32_t replaced_size = 0xA00;
+
+static uint8_t fill(const unsigned int seed, const uint32_t x)
+{
+    return seed * 0x35 + x * 7 + (x >> 8);
+}
+
+static void make_module(void *dest, const unsigned int id, const uint32_t size, const unsigned int seed)
+{
+    ncch_h *module = dest;
+    for (uint32_t x = 0; x < size; x++) ((uint8_t *)dest)[x] = fill(seed, x);
+    module->magic = NCCH_MAGIC;
+    module->contentSize = size / 0x200;
+    memset(module->programID, 0, 8);
+    module->programID[0] = id;
+    module->programID[4] = 0x13;
+}
+
+// Where a FIRM patch lands in a module, past its header.
+static uint32_t patch_spot(const enum modules module)
+{
+    return 0x200 + module * 0x20;
+}
+
+static firm_h *make_firm(uint32_t *firm_size)
+{
+    firm_h *firm = calloc(1, FCRAM_SPACING);
+    if (!firm) return NULL;
+
+    firm->magic = FIRM_MAGIC;
+
+    uint32_t size = 0;
+    for (unsigned int x = MODULE_A; x <= MODULE_C; x++) {
+        make_module((void *)firm + SECTION0_OFFSET + size, x, module_sizes[x], x);
+        size += module_sizes[x];
+    }
+    memset((void *)firm + SECTION0_OFFSET + size, 0xEE, TAIL_SIZE);
+    size += TAIL_SIZE;
+
+    firm->section[0].offset = SECTION0_OFFSET;
+    firm->section[0].address = 0x1FF00000;
+    firm->section[0].size = size;
+    firm->section[0].type = FIRM_TYPE_ARM11;
+
+    firm->section[1].offset = SECTION0_OFFSET + size;
+    firm->section[1].address = 0x1FF80000;
+    firm->section[1].size = SECTION1_SIZE;
+    firm->section[1].type = FIRM_TYPE_ARM11;
+    for (uint32_t x = 0; x < SECTION1_SIZE; x++) ((uint8_t *)firm + firm->section[1].offset)[x] = fill(9, x);
+
+    for (unsigned int x = 0; x < 2; x++) {
+        sha(firm->section[x].hash, (uint8_t *)firm + firm->section[x].offset, firm->section[x].size, SHA_256_MODE);
+    }
+
+    *firm_size = firm->section[1].offset + SECTION1_SIZE;
+    return firm;
+}
+
+// FIRM patches to modules A, B and C and to section 1, B replaced and D added.
+static void *make_cake(const firm_h *firm, size_t *cake_size)
+{
+    const unsigned int patch_count = 6;
+    const size_t header_size = sizeof(struct cake_header) + patch_count * sizeof(struct patch) +
+                               patch_count * sizeof(struct patch_version);
+    const size_t size = header_size + 4 * PATCH_SIZE + replaced_size + module_sizes[MODULE_D];
+
+    uint8_t *cake = calloc(1, size);
+    if (!cake) return NULL;
+
+    struct cake_header *header = (void *)cake;
+    header->version = 2;
+    header->patch_count = patch_count;
+    header->patches_offset = sizeof(*header);
+    memcpy(header->description, "Test", 5);
+
+    struct patch *patches = (void *)(cake + header->patches_offset);
+    struct patch_version *versions = (void *)(patches + patch_count);
+    uint32_t offset = header_size;
+
+    for (unsigned int x = 0; x < patch_count; x++) {
+        struct patch *patch = &patches[x];
+        patch->firm_type = NATIVE_FIRM;
+        patch->version_count = 1;
+        patch->versions_offset = (uint8_t *)&versions[x] - cake;
+        versions[x].firm_version = FIRM_VERSION;
+        versions[x].console = console_o3ds;
+
+        if (x < 4) {
+            // The FIRM patches come first, so they're in the FIRM before the sysmodules are laid out.
+            patch->type = TYPE_FIRM;
+            patch->size = PATCH_SIZE;
+            if (x < 3) {
+                uint32_t module_offset = 0;
+                for (unsigned int y = 0; y < x; y++) module_offset += module_sizes[y];
+                versions[x].file_offset = SECTION0_OFFSET + module_offset + patch_spot(x);
+                versions[x].offset = firm->section[0].address + module_offset + patch_spot(x);
+            } else {
+                versions[x].file_offset = firm->section[1].offset + 0x100;
+                versions[x].offset = firm->section[1].address + 0x100;
+            }
+            memset(cake + offset, 0xA0 + x, PATCH_SIZE);
+        } else {
+            unsigned int id = x == 4 ? MODULE_B : MODULE_D;
+            patch->type = TYPE_SYSMODULE;
+            patch->size = x == 4 ? replaced_size : module_sizes[MODULE_D];
+            make_module(cake + offset, id, patch->size, 0x10 + id);
+        }
+
+        patch->offset = offset;
+        offset += patch->size;
+    }
+
+    *cake_size = size;
+    return cake;
+}
+
+// What section 0 should look like: A and C patched, the new B, D behind them, then the tail.
+static uint8_t *expected_section(const firm_h *orig, uint32_t *size)
+{
+    uint8_t *section = malloc(replaced_size + module_sizes[MODULE_A] + module_sizes[MODULE_C] +
+                              module_sizes[MODULE_D] + TAIL_SIZE);
+    if (!section) return NULL;
+
+    const uint8_t *orig_modules = (uint8_t *)orig + orig->section[0].offset;
+    uint32_t orig_offset = 0;
+    *size = 0;
+
+    for (unsigned int x = MODULE_A; x <= MODULE_C; x++) {
+        if (x == MODULE_B) {
+            make_module(section + *size, x, replaced_size, 0x10 + x);
+            *size += replaced_size;
+        } else {
+            memcpy(section + *size, orig_modules + orig_offset, module_sizes[x]);
+            memset(section + *size + patch_spot(x), 0xA0 + x, PATCH_SIZE);
+            *size += module_sizes[x];
+        }
+        orig_offset += module_sizes[x];
+    }
+
+    make_module(section + *size, MODULE_D, module_sizes[MODULE_D], 0x10 + MODULE_D);
+    *size += module_sizes[MODULE_D];
+
+    memcpy(section + *size, orig_modules + orig_offset, TAIL_SIZE);
+    *size += TAIL_SIZE;
+
+    return section;
+}
+
+static int check_firm(const firm_h *firm, const firm_h *orig, const uint8_t *expected, const uint32_t expected_size,
+                      const char *when)
+{
+    // It outgrew its place, so it goes after section 1.
+    const uint32_t expected_offset = (orig->section[1].offset + SECTION1_SIZE + 0x1FF) & ~0x1FF;
+    uint8_t hash[SHA_256_HASH_SIZE];
+
+    check(firm->section[0].offset == expected_offset && firm->section[0].size == expected_size,
+          "%s: section 0 at 0x%X, 0x%X bytes, expected 0x%X, 0x%X bytes", when,
+          firm->section[0].offset, firm->section[0].size, expected_offset, expected_size);
+
+    const uint8_t *section = (uint8_t *)firm + firm->section[0].offset;
+    for (uint32_t x = 0; x < expected_size; x++) {
+        check(section[x] == expected[x], "%s: section 0 differs at 0x%X", when, x);
+    }
+
+    sha(hash, section, expected_size, SHA_256_MODE);
+    check(memcmp(hash, firm->section[0].hash, sizeof(hash)) == 0, "%s: section 0 doesn't match its hash", when);
+
+    // Section 1 only has its own FIRM patch.
+    check(memcmp(&firm->section[1], &orig->section[1], offsetof(firm_section_h, hash)) == 0,
+          "%s: section 1 moved", when);
+    const uint8_t *section1 = (uint8_t *)firm + firm->section[1].offset;
+    const uint8_t *orig_section1 = (uint8_t *)orig + orig->section[1].offset;
+    for (uint32_t x = 0; x < SECTION1_SIZE; x++) {
+        uint8_t byte = x >= 0x100 && x < 0x100 + PATCH_SIZE ? 0xA3 : orig_section1[x];
+        check(section1[x] == byte, "%s: section 1 differs at 0x%X", when, x);
+    }
+
+    return 0;
+
+error:
+    return 1;
+}
+
+int main()
+{
+    int rc = 0;
+    firm_h *orig = NULL;
+    void *cake = NULL;
+    uint8_t *expected = NULL;
+    uint32_t firm_size, expected_size;
+    size_t cake_size;
+
+    struct firm_signature signature = {.version = FIRM_VERSION, .console = console_o3ds};
+    current_firm = &signature;
+
+    memory_loc = malloc(FCRAM_SPACING);
+    firm_loc = make_firm(&firm_size);
+    orig = make_firm(&firm_size);
+    check(memory_loc && firm_loc && orig, "Failed to allocate memory");
+    firm_orig_loc = orig;
+
+    cake = make_cake(orig, &cake_size);
+    expected = expected_section(orig, &expected_size);
+    check(cake && expected, "Failed to allocate memory");
+
+    patch_reset();
+    check(patch_firm(cake, cake_size) == 0, "Failed to apply the cake");
+    check(rebuild_sysmodules() == 0, "Failed to rebuild the sysmodules");
+    if (check_firm(firm_loc, orig, expected, expected_size, "First rebuild") != 0) goto error;
+
+    // The next rebuild starts from this layout, and has to end up with the same.
+    check(rebuild_sysmodules() == 0, "Failed to rebuild the sysmodules again");
+    if (check_firm(firm_loc, orig, expected, expected_size, "Second rebuild") != 0) goto error;
+
+    printf("Section 0 rebuilt twice with 2 of 3 module patches kept, 1 module replaced and 1 added\n");
+    goto cleanup;
+
+error:
+    rc = 1;
+
+cleanup:
+    free(memory_loc);
+    free(firm_loc);
+    free(orig);
+    free(cake);
+    free(expected);
+    return rc;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// Shared by the host tests and benchmarks in this directory.
+
+#include <stdio.h>
+
+// Prints the message and jumps to the error label of the calling function if the condition doesn't hold.
+#define check(condition, message, ...) if (!(condition)) { fprintf(stderr, message "\n", ##__VA_ARGS__); goto error; }